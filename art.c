@@ -0,0 +1,701 @@
+/*-
+ * Copyright (c) 2017 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "art.h"
+
+#define ART_NODE4	0
+#define ART_NODE16	1
+#define ART_NODE48	2
+#define ART_NODE256	3
+
+/*
+ * Only the first ART_MAX_PREFIX bytes of a compressed path are kept in the
+ * node. Lookups skip over the rest and compare the whole key once they
+ * reach the leaf.
+ */
+#define ART_MAX_PREFIX	8
+
+typedef struct art_node {
+	uint8_t type;
+	uint8_t nchildren;
+	uint32_t prefixlen;
+	unsigned char prefix[ART_MAX_PREFIX];
+} art_node;
+
+/* The keys of Node4 and Node16 are sorted, which keeps the words in order */
+typedef struct art_node4 {
+	art_node n;
+	unsigned char keys[4];
+	art_node *children[4];
+} art_node4;
+
+typedef struct art_node16 {
+	art_node n;
+	unsigned char keys[16];
+	art_node *children[16];
+} art_node16;
+
+/* index holds one plus the slot of the child for each byte, 0 if none */
+typedef struct art_node48 {
+	art_node n;
+	unsigned char index[256];
+	art_node *children[48];
+} art_node48;
+
+typedef struct art_node256 {
+	art_node n;
+	art_node *children[256];
+} art_node256;
+
+/*
+ * Leaves hold the whole key, including its NUL so that no key is a prefix
+ * of another. They hang from the child slots as tagged pointers.
+ */
+typedef struct art_leaf {
+	uint32_t value;
+	uint32_t len;
+	unsigned char key[];
+} art_leaf;
+
+#define IS_LEAF(x)	(((uintptr_t) (x)) & 1)
+#define LEAF(x)		((art_leaf *) ((uintptr_t) (x) & ~(uintptr_t) 1))
+#define MAKE_LEAF(x)	((art_node *) ((uintptr_t) (x) | 1))
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+
+static art_node *
+alloc_node(uint8_t type)
+{
+	art_node *n;
+
+	switch (type) {
+	case ART_NODE4:
+		n = calloc(1, sizeof(art_node4));
+		break;
+	case ART_NODE16:
+		n = calloc(1, sizeof(art_node16));
+		break;
+	case ART_NODE48:
+		n = calloc(1, sizeof(art_node48));
+		break;
+	default:
+		n = calloc(1, sizeof(art_node256));
+		break;
+	}
+	if (n == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	n->type = type;
+	return n;
+}
+
+static art_leaf *
+alloc_leaf(const unsigned char *key, size_t len, size_t value)
+{
+	art_leaf *l = malloc(sizeof(*l) + len);
+
+	if (l == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	l->value = value > UINT32_MAX ? UINT32_MAX : value;
+	l->len = len;
+	memcpy(l->key, key, len);
+	return l;
+}
+
+art_t *
+art_init(void)
+{
+	art_t *t = malloc(sizeof(*t));
+
+	if (t == NULL)
+		return NULL;
+	t->root = NULL;
+	t->size = 0;
+	return t;
+}
+
+static void
+destroy_node(art_node *n)
+{
+	int i;
+
+	if (n == NULL)
+		return;
+	if (IS_LEAF(n)) {
+		free(LEAF(n));
+		return;
+	}
+
+	switch (n->type) {
+	case ART_NODE4:
+		for (i = 0; i < n->nchildren; i++)
+			destroy_node(((art_node4 *) n)->children[i]);
+		break;
+	case ART_NODE16:
+		for (i = 0; i < n->nchildren; i++)
+			destroy_node(((art_node16 *) n)->children[i]);
+		break;
+	case ART_NODE48:
+		for (i = 0; i < n->nchildren; i++)
+			destroy_node(((art_node48 *) n)->children[i]);
+		break;
+	default:
+		for (i = 0; i < 256; i++)
+			destroy_node(((art_node256 *) n)->children[i]);
+		break;
+	}
+	free(n);
+}
+
+void
+art_destroy(art_t *t)
+{
+	if (t == NULL)
+		return;
+	destroy_node(t->root);
+	free(t);
+}
+
+/*
+ * Returns the child slot for byte c, or NULL if there is none. Node16 is
+ * searched with one SSE2 compare of all its keys when available.
+ */
+static art_node **
+find_child(art_node *n, unsigned char c)
+{
+	art_node4 *p4;
+	art_node16 *p16;
+	art_node48 *p48;
+	art_node256 *p256;
+	int i;
+#ifdef __SSE2__
+	__m128i cmp;
+	unsigned int mask;
+#endif
+
+	switch (n->type) {
+	case ART_NODE4:
+		p4 = (art_node4 *) n;
+		for (i = 0; i < n->nchildren; i++)
+			if (p4->keys[i] == c)
+				return &p4->children[i];
+		return NULL;
+	case ART_NODE16:
+		p16 = (art_node16 *) n;
+#ifdef __SSE2__
+		cmp = _mm_cmpeq_epi8(_mm_set1_epi8((char) c),
+		    _mm_loadu_si128((const __m128i *) p16->keys));
+		mask = _mm_movemask_epi8(cmp) & ((1U << n->nchildren) - 1);
+		if (mask != 0)
+			return &p16->children[__builtin_ctz(mask)];
+#else
+		for (i = 0; i < n->nchildren; i++)
+			if (p16->keys[i] == c)
+				return &p16->children[i];
+#endif
+		return NULL;
+	case ART_NODE48:
+		p48 = (art_node48 *) n;
+		if (p48->index[c] == 0)
+			return NULL;
+		return &p48->children[p48->index[c] - 1];
+	default:
+		p256 = (art_node256 *) n;
+		if (p256->children[c] == NULL)
+			return NULL;
+		return &p256->children[c];
+	}
+}
+
+/* The leaf with the smallest key under n */
+static art_leaf *
+minimum(const art_node *n)
+{
+	const art_node48 *p48;
+	const art_node256 *p256;
+	int i;
+
+	while (!IS_LEAF(n)) {
+		switch (n->type) {
+		case ART_NODE4:
+			n = ((const art_node4 *) n)->children[0];
+			break;
+		case ART_NODE16:
+			n = ((const art_node16 *) n)->children[0];
+			break;
+		case ART_NODE48:
+			p48 = (const art_node48 *) n;
+			for (i = 0; p48->index[i] == 0; i++)
+				;
+			n = p48->children[p48->index[i] - 1];
+			break;
+		default:
+			p256 = (const art_node256 *) n;
+			for (i = 0; p256->children[i] == NULL; i++)
+				;
+			n = p256->children[i];
+			break;
+		}
+	}
+	return LEAF(n);
+}
+
+/*
+ * Number of bytes of the compressed path of n matching key from depth on,
+ * looking at the whole path, not just the stored part of it.
+ */
+static uint32_t
+prefix_mismatch(const art_node *n, const unsigned char *key, size_t len,
+    size_t depth)
+{
+	uint32_t max = MIN(MIN(n->prefixlen, ART_MAX_PREFIX), len - depth);
+	const art_leaf *l;
+	uint32_t i;
+
+	for (i = 0; i < max; i++)
+		if (n->prefix[i] != key[depth + i])
+			return i;
+
+	if (n->prefixlen > ART_MAX_PREFIX) {
+		l = minimum(n);
+		max = MIN(n->prefixlen, MIN(l->len, len) - depth);
+		for (; i < max; i++)
+			if (l->key[depth + i] != key[depth + i])
+				return i;
+	}
+	return i;
+}
+
+static void
+add_child256(art_node256 *n, unsigned char c, art_node *child)
+{
+	n->n.nchildren++;
+	n->children[c] = child;
+}
+
+static void
+add_child48(art_node48 *n, art_node **ref, unsigned char c, art_node *child)
+{
+	art_node256 *bigger;
+	int i;
+
+	if (n->n.nchildren < 48) {
+		n->children[n->n.nchildren] = child;
+		n->index[c] = ++n->n.nchildren;
+		return;
+	}
+
+	bigger = (art_node256 *) alloc_node(ART_NODE256);
+	for (i = 0; i < 256; i++)
+		if (n->index[i] != 0)
+			bigger->children[i] = n->children[n->index[i] - 1];
+	bigger->n.nchildren = n->n.nchildren;
+	bigger->n.prefixlen = n->n.prefixlen;
+	memcpy(bigger->n.prefix, n->n.prefix, sizeof(n->n.prefix));
+	*ref = &bigger->n;
+	free(n);
+	add_child256(bigger, c, child);
+}
+
+static void
+add_child16(art_node16 *n, art_node **ref, unsigned char c, art_node *child)
+{
+	art_node48 *bigger;
+	int i;
+
+	if (n->n.nchildren < 16) {
+		for (i = 0; i < n->n.nchildren && n->keys[i] < c; i++)
+			;
+		memmove(n->keys + i + 1, n->keys + i, n->n.nchildren - i);
+		memmove(n->children + i + 1, n->children + i,
+		    (n->n.nchildren - i) * sizeof(*n->children));
+		n->keys[i] = c;
+		n->children[i] = child;
+		n->n.nchildren++;
+		return;
+	}
+
+	bigger = (art_node48 *) alloc_node(ART_NODE48);
+	memcpy(bigger->children, n->children, sizeof(n->children));
+	for (i = 0; i < 16; i++)
+		bigger->index[n->keys[i]] = i + 1;
+	bigger->n.nchildren = n->n.nchildren;
+	bigger->n.prefixlen = n->n.prefixlen;
+	memcpy(bigger->n.prefix, n->n.prefix, sizeof(n->n.prefix));
+	*ref = &bigger->n;
+	free(n);
+	add_child48(bigger, ref, c, child);
+}
+
+static void
+add_child4(art_node4 *n, art_node **ref, unsigned char c, art_node *child)
+{
+	art_node16 *bigger;
+	int i;
+
+	if (n->n.nchildren < 4) {
+		for (i = 0; i < n->n.nchildren && n->keys[i] < c; i++)
+			;
+		memmove(n->keys + i + 1, n->keys + i, n->n.nchildren - i);
+		memmove(n->children + i + 1, n->children + i,
+		    (n->n.nchildren - i) * sizeof(*n->children));
+		n->keys[i] = c;
+		n->children[i] = child;
+		n->n.nchildren++;
+		return;
+	}
+
+	bigger = (art_node16 *) alloc_node(ART_NODE16);
+	memcpy(bigger->keys, n->keys, sizeof(n->keys));
+	memcpy(bigger->children, n->children, sizeof(n->children));
+	bigger->n.nchildren = n->n.nchildren;
+	bigger->n.prefixlen = n->n.prefixlen;
+	memcpy(bigger->n.prefix, n->n.prefix, sizeof(n->n.prefix));
+	*ref = &bigger->n;
+	free(n);
+	add_child16(bigger, ref, c, child);
+}
+
+static void
+add_child(art_node *n, art_node **ref, unsigned char c, art_node *child)
+{
+	switch (n->type) {
+	case ART_NODE4:
+		add_child4((art_node4 *) n, ref, c, child);
+		break;
+	case ART_NODE16:
+		add_child16((art_node16 *) n, ref, c, child);
+		break;
+	case ART_NODE48:
+		add_child48((art_node48 *) n, ref, c, child);
+		break;
+	default:
+		add_child256((art_node256 *) n, c, child);
+		break;
+	}
+}
+
+static int
+leaf_matches(const art_leaf *l, const unsigned char *key, size_t len)
+{
+	return l->len == len && memcmp(l->key, key, len) == 0;
+}
+
+/*
+ * art_insert--
+ *  Adds key to the tree with the given value, or updates the value if
+ *  the key is already there.
+ */
+void
+art_insert(art_t *t, const char *word, size_t value)
+{
+	const unsigned char *key = (const unsigned char *) word;
+	size_t len = strlen(word) + 1;
+	size_t depth = 0;
+	art_node **ref = &t->root;
+	art_node *n, **child;
+	art_node4 *split;
+	art_leaf *l;
+	uint32_t common, limit;
+
+	for (;;) {
+		n = *ref;
+		if (n == NULL) {
+			*ref = MAKE_LEAF(alloc_leaf(key, len, value));
+			t->size++;
+			return;
+		}
+
+		if (IS_LEAF(n)) {
+			l = LEAF(n);
+			if (leaf_matches(l, key, len)) {
+				l->value = value > UINT32_MAX ? UINT32_MAX : value;
+				return;
+			}
+			/* Both keys end in NUL, so they differ before either ends */
+			limit = MIN(l->len, len);
+			for (common = 0; depth + common < limit; common++)
+				if (l->key[depth + common] != key[depth + common])
+					break;
+			split = (art_node4 *) alloc_node(ART_NODE4);
+			split->n.prefixlen = common;
+			memcpy(split->n.prefix, key + depth, MIN(common, ART_MAX_PREFIX));
+			add_child4(split, ref, l->key[depth + common], n);
+			add_child4(split, ref, key[depth + common],
+			    MAKE_LEAF(alloc_leaf(key, len, value)));
+			*ref = &split->n;
+			t->size++;
+			return;
+		}
+
+		if (n->prefixlen != 0) {
+			common = prefix_mismatch(n, key, len, depth);
+			if (common < n->prefixlen) {
+				/* The key leaves the compressed path, split it */
+				split = (art_node4 *) alloc_node(ART_NODE4);
+				split->n.prefixlen = common;
+				memcpy(split->n.prefix, n->prefix, MIN(common, ART_MAX_PREFIX));
+				if (n->prefixlen <= ART_MAX_PREFIX) {
+					add_child4(split, ref, n->prefix[common], n);
+					n->prefixlen -= common + 1;
+					memmove(n->prefix, n->prefix + common + 1,
+					    MIN(n->prefixlen, ART_MAX_PREFIX));
+				} else {
+					n->prefixlen -= common + 1;
+					l = minimum(n);
+					add_child4(split, ref, l->key[depth + common], n);
+					memcpy(n->prefix, l->key + depth + common + 1,
+					    MIN(n->prefixlen, ART_MAX_PREFIX));
+				}
+				add_child4(split, ref, key[depth + common],
+				    MAKE_LEAF(alloc_leaf(key, len, value)));
+				*ref = &split->n;
+				t->size++;
+				return;
+			}
+			depth += n->prefixlen;
+		}
+
+		if ((child = find_child(n, key[depth])) == NULL) {
+			add_child(n, ref, key[depth],
+			    MAKE_LEAF(alloc_leaf(key, len, value)));
+			t->size++;
+			return;
+		}
+		ref = child;
+		depth++;
+	}
+}
+
+/*
+ * art_get--
+ *  Returns the value stored for key, 0 if the key is not in the tree.
+ */
+size_t
+art_get(const art_t *t, const char *word)
+{
+	const unsigned char *key = (const unsigned char *) word;
+	size_t len = strlen(word) + 1;
+	size_t depth = 0;
+	art_node *n, **child;
+	art_leaf *l;
+	uint32_t i, max;
+
+	if (t == NULL)
+		return 0;
+
+	n = t->root;
+	while (n != NULL) {
+		if (IS_LEAF(n)) {
+			l = LEAF(n);
+			return leaf_matches(l, key, len) ? l->value : 0;
+		}
+		if (n->prefixlen != 0) {
+			/* Skipped bytes past the stored prefix are checked at the leaf */
+			max = MIN(n->prefixlen, ART_MAX_PREFIX);
+			if (depth + max > len)
+				return 0;
+			for (i = 0; i < max; i++)
+				if (n->prefix[i] != key[depth + i])
+					return 0;
+			depth += n->prefixlen;
+			if (depth >= len)
+				return 0;
+		}
+		if ((child = find_child(n, key[depth])) == NULL)
+			return 0;
+		n = *child;
+		depth++;
+	}
+	return 0;
+}
+
+/*
+ * art_prefix_len--
+ *  Returns the length of the longest prefix of word that some key of the
+ *  tree starts with. The compressed paths are compared in full, so unlike
+ *  art_get this cannot leave the last check to the leaf.
+ */
+size_t
+art_prefix_len(const art_t *t, const char *word)
+{
+	const unsigned char *key = (const unsigned char *) word;
+	size_t len = strlen(word);
+	size_t depth = 0;
+	art_node *n, **child;
+	const art_leaf *l;
+	uint32_t matched;
+
+	if (t == NULL)
+		return 0;
+
+	n = t->root;
+	while (n != NULL) {
+		if (IS_LEAF(n)) {
+			/* The stored length counts the terminating NUL */
+			l = LEAF(n);
+			while (depth < len && depth + 1 < l->len &&
+			    l->key[depth] == key[depth])
+				depth++;
+			return depth;
+		}
+		if (n->prefixlen != 0) {
+			matched = prefix_mismatch(n, key, len, depth);
+			if (matched < n->prefixlen)
+				return depth + matched;
+			depth += n->prefixlen;
+		}
+		if (depth == len)
+			return len;
+		if ((child = find_child(n, key[depth])) == NULL)
+			return depth;
+		n = *child;
+		depth++;
+	}
+	return depth;
+}
+
+typedef struct art_words {
+	char **list;
+	size_t n;
+	size_t size;
+} art_words;
+
+static void
+add_word(art_words *w, const art_leaf *l)
+{
+	char **list;
+
+	if (w->n + 1 >= w->size) {
+		w->size = w->size ? w->size * 2 : 16;
+		list = realloc(w->list, w->size * sizeof(*list));
+		if (list == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+		w->list = list;
+	}
+	if ((w->list[w->n++] = strdup((const char *) l->key)) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+}
+
+/* Adds every word under n, in ascending order */
+static void
+collect_words(const art_node *n, art_words *w)
+{
+	const art_node48 *p48;
+	const art_node256 *p256;
+	int i;
+
+	if (IS_LEAF(n)) {
+		add_word(w, LEAF(n));
+		return;
+	}
+
+	switch (n->type) {
+	case ART_NODE4:
+		for (i = 0; i < n->nchildren; i++)
+			collect_words(((const art_node4 *) n)->children[i], w);
+		break;
+	case ART_NODE16:
+		for (i = 0; i < n->nchildren; i++)
+			collect_words(((const art_node16 *) n)->children[i], w);
+		break;
+	case ART_NODE48:
+		p48 = (const art_node48 *) n;
+		for (i = 0; i < 256; i++)
+			if (p48->index[i] != 0)
+				collect_words(p48->children[p48->index[i] - 1], w);
+		break;
+	default:
+		p256 = (const art_node256 *) n;
+		for (i = 0; i < 256; i++)
+			if (p256->children[i] != NULL)
+				collect_words(p256->children[i], w);
+		break;
+	}
+}
+
+/*
+ * art_prefix_matches--
+ *  Returns a NULL terminated, sorted list of the words starting with
+ *  prefix, or NULL if there are none.
+ */
+char **
+art_prefix_matches(const art_t *t, const char *prefix)
+{
+	const unsigned char *key = (const unsigned char *) prefix;
+	size_t len = strlen(prefix);
+	size_t depth = 0;
+	art_words w = { NULL, 0, 0 };
+	art_node *n, **child;
+	art_leaf *l;
+	uint32_t common;
+
+	if (t == NULL || prefix == NULL)
+		return NULL;
+
+	n = t->root;
+	while (n != NULL) {
+		if (IS_LEAF(n)) {
+			l = LEAF(n);
+			if (l->len > len && memcmp(l->key, key, len) == 0)
+				add_word(&w, l);
+			break;
+		}
+		if (depth == len) {
+			collect_words(n, &w);
+			break;
+		}
+		if (n->prefixlen != 0) {
+			common = prefix_mismatch(n, key, len, depth);
+			if (depth + common == len) {
+				collect_words(n, &w);
+				break;
+			}
+			if (common < n->prefixlen)
+				break;
+			depth += n->prefixlen;
+		}
+		if ((child = find_child(n, key[depth])) == NULL)
+			break;
+		n = *child;
+		depth++;
+	}
+
+	if (w.n == 0)
+		return NULL;
+	w.list[w.n] = NULL;
+	return w.list;
+}
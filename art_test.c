@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "art.h"
+#include "test_util.h"
+#include "trie.h"
+
+/*
+ * Every third word also comes with an "ing" ending, and "z" is followed by
+ * every printable byte, which grows its node to the largest size.
+ */
+static size_t
+make_words(char words[][20], char **sorted, size_t *counts)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < NWORDS; i++) {
+		make_word(i, words[n]);
+		sorted[n] = words[n];
+		n++;
+		if (i % 3 == 0) {
+			make_word(i, words[n]);
+			strcat(words[n], "ing");
+			sorted[n] = words[n];
+			n++;
+		}
+	}
+	for (i = '!'; i <= '~'; i++) {
+		if (i >= 'a' && i <= 'z')
+			continue;
+		words[n][0] = 'z';
+		words[n][1] = i;
+		words[n][2] = 0;
+		sorted[n] = words[n];
+		n++;
+	}
+	qsort(sorted, n, sizeof(*sorted), compare_words);
+	for (i = 0; i < n; i++)
+		counts[i] = i + 1;
+	return n;
+}
+
+/* Both hold the same words, so they must give the same prefix matches */
+static int
+same_matches(trie_t *t, const art_t *a, const char *prefix)
+{
+	return same_words(get_prefix_matches(t, prefix),
+	    art_prefix_matches(a, prefix));
+}
+
+int
+main(int argc, char **argv)
+{
+	static char words[2 * NWORDS][20];
+	static char *sorted[2 * NWORDS];
+	static size_t counts[2 * NWORDS];
+	const char *probes[] = { "zzzz", "z~x", "ingx", "abcdefg", "b", "z" };
+	char prefix[20];
+	trie_t *t = trie_init();
+	art_t *a = art_init();
+	size_t i, j, n, bad;
+
+	n = make_words(words, sorted, counts);
+	trie_bulk_insert(&t, sorted, counts, n);
+	/* The tree takes the words in any order: give them unsorted */
+	for (i = 0; i < n; i++)
+		art_insert(a, words[i], trie_get(t, words[i]));
+
+	bad = 0;
+	for (i = 0; i < n; i++)
+		if (art_get(a, sorted[i]) != trie_get(t, sorted[i]))
+			bad++;
+	check(bad == 0, "lookup: every word agrees with the trie");
+	bad = 0;
+	for (i = 0; i < sizeof(probes) / sizeof(probes[0]); i++)
+		if (art_get(a, probes[i]) != trie_get(t, probes[i]) ||
+		    art_prefix_len(a, probes[i]) !=
+		    trie_prefix_len(t, probes[i]))
+			bad++;
+	check(bad == 0, "lookup: absent words and prefix lengths");
+
+	/* Every prefix of every 37th word, and the prefix cut one short */
+	bad = 0;
+	for (i = 0; i < n; i += 37)
+		for (j = 1; j <= strlen(sorted[i]); j++) {
+			memcpy(prefix, sorted[i], j);
+			prefix[j] = 0;
+			if (!same_matches(t, a, prefix))
+				bad++;
+		}
+	for (i = 0; i < sizeof(probes) / sizeof(probes[0]); i++)
+		if (!same_matches(t, a, probes[i]))
+			bad++;
+	check(bad == 0, "prefix: matches agree with the trie");
+
+	/* Inserting a word again updates its value */
+	art_insert(a, "aing", 7);
+	check(art_get(a, "aing") == 7 && art_get(a, "a") == trie_get(t, "a"),
+	    "insert: update in place");
+
+	art_destroy(a);
+	trie_destroy(t);
+	return test_result();
+}
@@ -0,0 +1,134 @@
+/*-
+ * Copyright (c) 2017 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bloom.h"
+
+#ifndef __NetBSD__
+void mi_vector_hash(const void * __restrict, size_t, uint32_t, uint32_t[3]);
+#endif
+
+/* Bits per key and bits set per key, for a false positive rate near 1% */
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_K 6
+
+/*
+ * bloom_init--
+ *  Returns an empty filter sized for nkeys keys.
+ */
+bloom_t *
+bloom_init(size_t nkeys)
+{
+	bloom_t *b;
+	size_t bits = nkeys * BLOOM_BITS_PER_KEY;
+
+	if ((b = malloc(sizeof(*b))) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	b->nblocks = bits / (BLOOM_BLOCK_WORDS * 64) + 1;
+	if (posix_memalign((void **) &b->blocks, BLOOM_BLOCK_WORDS * sizeof(uint64_t),
+	    b->nblocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t)) != 0)
+		err(EXIT_FAILURE, "malloc failed");
+	memset(b->blocks, 0, b->nblocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+	return b;
+}
+
+void
+bloom_hash(const void *key, size_t len, uint32_t seed, uint32_t hashes[3])
+{
+	mi_vector_hash(key, len, seed, hashes);
+}
+
+/*
+ * The block of a key comes from its first hash, its bits within the block
+ * from the other two by double hashing. The step is odd so that the bits
+ * do not cycle before BLOOM_K of them.
+ */
+static uint64_t *
+get_block(const bloom_t *b, const uint32_t hashes[3])
+{
+	return b->blocks + (size_t) hashes[0] % b->nblocks * BLOOM_BLOCK_WORDS;
+}
+
+static uint32_t
+get_bit(const uint32_t hashes[3], int i)
+{
+	return (hashes[1] + i * (hashes[2] | 1)) % (BLOOM_BLOCK_WORDS * 64);
+}
+
+/*
+ * bloom_add--
+ *  Adds the key with the given hashes. The bits are set atomically, so
+ *  keys can be added while other threads query the filter.
+ */
+void
+bloom_add(bloom_t *b, const uint32_t hashes[3])
+{
+	uint64_t *block = get_block(b, hashes);
+	uint32_t bit;
+	int i;
+
+	for (i = 0; i < BLOOM_K; i++) {
+		bit = get_bit(hashes, i);
+		__atomic_fetch_or(&block[bit / 64], (uint64_t) 1 << (bit % 64),
+		    __ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * bloom_test--
+ *  Returns 0 if the key with the given hashes was never added, 1 if it
+ *  probably was.
+ */
+int
+bloom_test(const bloom_t *b, const uint32_t hashes[3])
+{
+	const uint64_t *block = get_block(b, hashes);
+	uint32_t bit;
+	int i;
+
+	for (i = 0; i < BLOOM_K; i++) {
+		bit = get_bit(hashes, i);
+		if ((__atomic_load_n(&block[bit / 64], __ATOMIC_RELAXED) &
+		    (uint64_t) 1 << (bit % 64)) == 0)
+			return 0;
+	}
+	return 1;
+}
+
+void
+bloom_destroy(bloom_t *b)
+{
+	if (b == NULL)
+		return;
+	free(b->blocks);
+	free(b);
+}
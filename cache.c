@@ -0,0 +1,308 @@
+/*-
+ * Copyright (c) 2017 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "hash.h"
+
+/* Number of shards, a power of 2 */
+#define CACHE_SHARDS 16
+
+/*
+ * An entry holds a copy of its key followed by its value in data. Entries
+ * hashing to the same bucket are chained through next, which is one plus
+ * the index of the next entry, 0 at the end of the chain.
+ */
+typedef struct cache_entry {
+	char *data;
+	size_t keylen;
+	size_t valuelen;
+	uint32_t hash;
+	uint32_t next;
+	int referenced;
+} cache_entry;
+
+typedef struct cache_shard {
+	pthread_mutex_t lock;
+	cache_entry *entries;
+	size_t nentries;
+	size_t capacity;
+	uint32_t *buckets;
+	size_t nbuckets;
+	size_t hand;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+} cache_shard;
+
+struct cache {
+	cache_shard shards[CACHE_SHARDS];
+};
+
+static uint32_t
+hash_key(const void *key, size_t len)
+{
+	uint64_t h = fnv1a_hash(FNV1A_BASIS, key, len);
+
+	/*
+	 * FNV leaves the top bits of short keys poorly mixed, and those pick
+	 * the shard: spread them with a Fibonacci multiply.
+	 */
+	return (h * 0x9E3779B97F4A7C15ULL) >> 32;
+}
+
+static cache_shard *
+get_shard(cache_t *c, uint32_t hash)
+{
+	return &c->shards[hash >> 28 & (CACHE_SHARDS - 1)];
+}
+
+/*
+ * Returns the link pointing at the entry for key in s, or at the 0 ending
+ * its chain if it is not there.
+ */
+static uint32_t *
+find_entry(cache_shard *s, const void *key, size_t keylen, uint32_t hash)
+{
+	uint32_t *link = &s->buckets[hash & (s->nbuckets - 1)];
+	cache_entry *e;
+
+	while (*link != 0) {
+		e = &s->entries[*link - 1];
+		if (e->hash == hash && e->keylen == keylen &&
+		    memcmp(e->data, key, keylen) == 0)
+			break;
+		link = &e->next;
+	}
+	return link;
+}
+
+/*
+ * Picks the entry to make room with: the hand sweeps around the entries,
+ * giving a second chance to those used since it last went past them.
+ * The chosen one is unlinked from its chain and freed.
+ */
+static cache_entry *
+evict_entry(cache_shard *s)
+{
+	cache_entry *e;
+	uint32_t *link;
+
+	for (;;) {
+		e = &s->entries[s->hand];
+		s->hand = (s->hand + 1) % s->capacity;
+		if (!e->referenced)
+			break;
+		e->referenced = 0;
+	}
+	link = find_entry(s, e->data, e->keylen, e->hash);
+	*link = e->next;
+	free(e->data);
+	s->evictions++;
+	return e;
+}
+
+/*
+ * cache_init--
+ *  Returns a cache holding at most about nentries entries, NULL if
+ *  nentries is 0.
+ */
+cache_t *
+cache_init(size_t nentries)
+{
+	cache_t *c;
+	cache_shard *s;
+	size_t i, capacity;
+
+	if (nentries == 0)
+		return NULL;
+	if ((c = calloc(1, sizeof(*c))) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+
+	capacity = (nentries + CACHE_SHARDS - 1) / CACHE_SHARDS;
+	for (i = 0; i < CACHE_SHARDS; i++) {
+		s = &c->shards[i];
+		pthread_mutex_init(&s->lock, NULL);
+		s->capacity = capacity;
+		s->nbuckets = 1;
+		while (s->nbuckets < capacity)
+			s->nbuckets *= 2;
+		s->entries = calloc(capacity, sizeof(*s->entries));
+		s->buckets = calloc(s->nbuckets, sizeof(*s->buckets));
+		if (s->entries == NULL || s->buckets == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+	}
+	return c;
+}
+
+/*
+ * cache_get--
+ *  Looks up key. On a hit it returns 1 with a malloc'd copy of the value
+ *  in *value, NULL if the value is empty, and its length in *valuelen.
+ *  Returns 0 on a miss.
+ */
+int
+cache_get(cache_t *c, const void *key, size_t keylen, char **value,
+    size_t *valuelen)
+{
+	uint32_t hash = hash_key(key, keylen);
+	cache_shard *s = get_shard(c, hash);
+	cache_entry *e;
+	uint32_t *link;
+
+	pthread_mutex_lock(&s->lock);
+	link = find_entry(s, key, keylen, hash);
+	if (*link == 0) {
+		s->misses++;
+		pthread_mutex_unlock(&s->lock);
+		return 0;
+	}
+	e = &s->entries[*link - 1];
+	e->referenced = 1;
+	s->hits++;
+	*valuelen = e->valuelen;
+	*value = NULL;
+	if (e->valuelen != 0) {
+		if ((*value = malloc(e->valuelen)) == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+		memcpy(*value, e->data + e->keylen, e->valuelen);
+	}
+	pthread_mutex_unlock(&s->lock);
+	return 1;
+}
+
+/*
+ * cache_put--
+ *  Stores a copy of value under key, replacing whatever was stored there.
+ *  A full shard evicts one of its entries first.
+ */
+void
+cache_put(cache_t *c, const void *key, size_t keylen, const void *value,
+    size_t valuelen)
+{
+	uint32_t hash = hash_key(key, keylen);
+	cache_shard *s = get_shard(c, hash);
+	cache_entry *e;
+	uint32_t *link;
+	char *data;
+
+	if ((data = malloc(keylen + valuelen)) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	memcpy(data, key, keylen);
+	memcpy(data + keylen, value, valuelen);
+
+	pthread_mutex_lock(&s->lock);
+	link = find_entry(s, key, keylen, hash);
+	if (*link != 0) {
+		e = &s->entries[*link - 1];
+		free(e->data);
+	} else {
+		if (s->nentries < s->capacity)
+			e = &s->entries[s->nentries++];
+		else
+			e = evict_entry(s);
+		/* The eviction may have changed the chain of key */
+		link = &s->buckets[hash & (s->nbuckets - 1)];
+		e->hash = hash;
+		e->keylen = keylen;
+		e->next = *link;
+		*link = e - s->entries + 1;
+	}
+	e->data = data;
+	e->valuelen = valuelen;
+	e->referenced = 0;
+	pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * cache_clear--
+ *  Drops every entry, keeping the statistics.
+ */
+void
+cache_clear(cache_t *c)
+{
+	cache_shard *s;
+	size_t i, j;
+
+	if (c == NULL)
+		return;
+	for (i = 0; i < CACHE_SHARDS; i++) {
+		s = &c->shards[i];
+		pthread_mutex_lock(&s->lock);
+		for (j = 0; j < s->nentries; j++)
+			free(s->entries[j].data);
+		memset(s->buckets, 0, s->nbuckets * sizeof(*s->buckets));
+		s->nentries = 0;
+		s->hand = 0;
+		pthread_mutex_unlock(&s->lock);
+	}
+}
+
+void
+cache_get_stats(cache_t *c, cache_stats *stats)
+{
+	cache_shard *s;
+	size_t i;
+
+	memset(stats, 0, sizeof(*stats));
+	if (c == NULL)
+		return;
+	for (i = 0; i < CACHE_SHARDS; i++) {
+		s = &c->shards[i];
+		pthread_mutex_lock(&s->lock);
+		stats->hits += s->hits;
+		stats->misses += s->misses;
+		stats->evictions += s->evictions;
+		stats->entries += s->nentries;
+		pthread_mutex_unlock(&s->lock);
+	}
+}
+
+void
+cache_destroy(cache_t *c)
+{
+	cache_shard *s;
+	size_t i, j;
+
+	if (c == NULL)
+		return;
+	for (i = 0; i < CACHE_SHARDS; i++) {
+		s = &c->shards[i];
+		for (j = 0; j < s->nentries; j++)
+			free(s->entries[j].data);
+		free(s->entries);
+		free(s->buckets);
+		pthread_mutex_destroy(&s->lock);
+	}
+	free(c);
+}
@@ -0,0 +1,227 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "test_util.h"
+
+#define NTHREADS 4
+
+/* The cache maps words[i] to i */
+static char words[NWORDS][16];
+
+typedef struct cache_job {
+	cache_t *cache;
+	size_t start;
+	size_t bad;
+} cache_job;
+
+static void
+put_word(cache_t *c, size_t i)
+{
+	cache_put(c, words[i], strlen(words[i]), &i, sizeof(i));
+}
+
+/* Returns 1 on a hit with the index of the word, 0 on a miss, -1 if wrong */
+static int
+get_word(cache_t *c, size_t i)
+{
+	char *value;
+	size_t len, stored;
+
+	if (!cache_get(c, words[i], strlen(words[i]), &value, &len))
+		return 0;
+	if (len != sizeof(stored)) {
+		free(value);
+		return -1;
+	}
+	memcpy(&stored, value, sizeof(stored));
+	free(value);
+	return stored == i ? 1 : -1;
+}
+
+/* With room for every word nothing is evicted and nothing is missed */
+static void
+test_lookup(void)
+{
+	cache_t *c = cache_init(2 * NWORDS);
+	cache_stats stats;
+	char *value;
+	size_t i, len, bad = 0;
+
+	for (i = 0; i < NWORDS; i++)
+		put_word(c, i);
+	for (i = 0; i < NWORDS; i++)
+		if (get_word(c, i) != 1)
+			bad++;
+	check(bad == 0, "lookup: every word has its value");
+	check(cache_get(c, "zzzzz", 5, &value, &len) == 0 &&
+	    cache_get(c, "", 0, &value, &len) == 0, "lookup: absent keys");
+
+	/* Storing a key again replaces its value, empty ones included */
+	cache_put(c, words[0], strlen(words[0]), "", 0);
+	check(cache_get(c, words[0], strlen(words[0]), &value, &len) == 1 &&
+	    value == NULL && len == 0, "lookup: empty value");
+	put_word(c, 0);
+
+	cache_get_stats(c, &stats);
+	check(stats.hits == NWORDS + 1 && stats.misses == 2 &&
+	    stats.evictions == 0 && stats.entries == NWORDS,
+	    "stats: hits, misses and entries");
+
+	cache_clear(c);
+	cache_get_stats(c, &stats);
+	check(stats.entries == 0 && get_word(c, 0) == 0,
+	    "clear: every entry dropped");
+	put_word(c, 1);
+	check(get_word(c, 1) == 1, "clear: the cache works again");
+	cache_destroy(c);
+}
+
+/* A small cache stays within its size, and what it keeps is right */
+static void
+test_eviction(void)
+{
+	cache_t *c = cache_init(64);
+	cache_stats stats;
+	size_t i, hits = 0, bad = 0;
+	int r;
+
+	for (i = 0; i < NWORDS; i++)
+		put_word(c, i);
+	for (i = 0; i < NWORDS; i++) {
+		if ((r = get_word(c, i)) == -1)
+			bad++;
+		hits += r == 1;
+	}
+	cache_get_stats(c, &stats);
+	check(bad == 0, "eviction: the entries kept have their value");
+	check(stats.entries <= 64 && stats.entries == hits,
+	    "eviction: bounded size");
+	check(stats.evictions == NWORDS - stats.entries,
+	    "eviction: one per put past the size");
+	cache_destroy(c);
+}
+
+/*
+ * Finds n words sharing a shard with words[0]. With one entry per shard,
+ * putting a word right after words[0] evicts it if and only if the two
+ * share a shard.
+ */
+static size_t
+same_shard(size_t *found, size_t n)
+{
+	cache_t *c = cache_init(1);
+	cache_stats before, after;
+	size_t i, nfound = 0;
+
+	for (i = 1; i < NWORDS && nfound < n; i++) {
+		cache_clear(c);
+		put_word(c, 0);
+		cache_get_stats(c, &before);
+		put_word(c, i);
+		cache_get_stats(c, &after);
+		if (after.evictions > before.evictions)
+			found[nfound++] = i;
+	}
+	cache_destroy(c);
+	return nfound;
+}
+
+/*
+ * CLOCK gives a referenced entry a second chance: the hand clears its
+ * bit and goes on to the next entry, and only takes it on its next round.
+ * An entry nobody looked up is taken at once.
+ */
+static void
+test_second_chance(void)
+{
+	size_t w[3];
+	cache_t *c;
+
+	check(same_shard(w, 3) == 3, "clock: words sharing a shard");
+	/* Two entries per shard, the hand on words[0] */
+	c = cache_init(32);
+	put_word(c, 0);
+	put_word(c, w[0]);
+	check(get_word(c, 0) == 1, "clock: hit");
+	/* One of the two goes: not words[0], which a lookup would reference */
+	put_word(c, w[1]);
+	check(get_word(c, w[0]) == 0,
+	    "clock: referenced entry survives the sweep");
+	/* Its chance used up, the next put takes it */
+	put_word(c, w[2]);
+	check(get_word(c, 0) == 0 && get_word(c, w[1]) == 1 &&
+	    get_word(c, w[2]) == 1, "clock: then evicted on the next round");
+	cache_destroy(c);
+
+	/* Without the lookup, the entry under the hand goes first */
+	c = cache_init(32);
+	put_word(c, 0);
+	put_word(c, w[0]);
+	put_word(c, w[1]);
+	check(get_word(c, 0) == 0 && get_word(c, w[0]) == 1,
+	    "clock: unreferenced entry evicted");
+	cache_destroy(c);
+}
+
+static void *
+run_job(void *arg)
+{
+	cache_job *job = arg;
+	size_t i, j;
+
+	for (i = 0; i < NWORDS; i++) {
+		j = (job->start + i * 7) % NWORDS;
+		if (get_word(job->cache, j) == -1)
+			job->bad++;
+		put_word(job->cache, j);
+	}
+	return NULL;
+}
+
+/* Threads sharing the words never see a value torn or misplaced */
+static void
+test_threads(void)
+{
+	pthread_t threads[NTHREADS];
+	cache_job jobs[NTHREADS];
+	cache_t *c = cache_init(NWORDS / 4);
+	cache_stats stats;
+	size_t i, bad = 0;
+
+	for (i = 0; i < NTHREADS; i++) {
+		jobs[i].cache = c;
+		jobs[i].start = i * NWORDS / NTHREADS;
+		jobs[i].bad = 0;
+		if (pthread_create(&threads[i], NULL, run_job, &jobs[i]) != 0) {
+			printf("pthread_create failed\n");
+			exit(1);
+		}
+	}
+	for (i = 0; i < NTHREADS; i++) {
+		pthread_join(threads[i], NULL);
+		bad += jobs[i].bad;
+	}
+	cache_get_stats(c, &stats);
+	check(bad == 0, "threads: every hit has its value");
+	check(stats.hits + stats.misses == NTHREADS * NWORDS,
+	    "threads: every lookup counted");
+	cache_destroy(c);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t i;
+
+	for (i = 0; i < NWORDS; i++)
+		make_word(i, words[i]);
+	check(cache_init(0) == NULL, "cache_init: no entries");
+	test_lookup();
+	test_eviction();
+	test_second_chance();
+	test_threads();
+	return test_result();
+}
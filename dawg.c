@@ -0,0 +1,452 @@
+/*-
+ * Copyright (c) 2017 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dawg.h"
+#include "hash.h"
+
+/*
+ * The node currently being built at one depth of the incremental
+ * construction. Its last edge is still open: its destination is only
+ * known once the subtree below it has been minimized.
+ */
+typedef struct dawg_pending {
+	unsigned char labels[256];
+	uint32_t dests[256];
+	size_t nedges;
+	int final;
+} dawg_pending;
+
+typedef struct dawg_builder {
+	dawg_t *d;
+	uint32_t *nwords;	/* number of words accepted from each node */
+	size_t nodes_size;
+	size_t edges_size;
+	uint32_t *table;	/* register of unique nodes, node id + 1 per slot */
+	size_t table_size;
+	size_t table_used;
+	dawg_pending *levels;
+	size_t nlevels;
+} dawg_builder;
+
+#define EDGE_START(d, i) ((d)->first_edge[i] & ~DAWG_FINAL)
+
+static void *
+xrealloc(void *p, size_t nmemb, size_t size)
+{
+	if (nmemb != 0 && SIZE_MAX / nmemb < size)
+		errx(EXIT_FAILURE, "dawg: too large");
+	if ((p = realloc(p, nmemb * size)) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	return p;
+}
+
+static uint32_t
+hash_edges(int final, const unsigned char *labels, const uint32_t *dests,
+    size_t nedges)
+{
+	uint64_t h = FNV1A_BASIS ^ (final != 0);
+
+	h = fnv1a_hash(h, labels, nedges);
+	return fnv1a_hash(h, dests, nedges * sizeof(*dests));
+}
+
+static uint32_t
+edge_end(const dawg_builder *b, uint32_t id)
+{
+	return id + 1 < b->d->nnodes ? EDGE_START(b->d, id + 1) : b->d->nedges;
+}
+
+static uint32_t
+hash_node(const dawg_builder *b, uint32_t id)
+{
+	const dawg_t *d = b->d;
+	uint32_t start = EDGE_START(d, id);
+
+	return hash_edges(d->first_edge[id] & DAWG_FINAL, d->labels + start,
+	    d->dests + start, edge_end(b, id) - start);
+}
+
+static int
+same_node(const dawg_builder *b, uint32_t id, const dawg_pending *p)
+{
+	const dawg_t *d = b->d;
+	uint32_t start = EDGE_START(d, id);
+
+	if (((d->first_edge[id] & DAWG_FINAL) != 0) != (p->final != 0))
+		return 0;
+	if (edge_end(b, id) - start != p->nedges)
+		return 0;
+	return memcmp(d->labels + start, p->labels, p->nedges) == 0 &&
+	    memcmp(d->dests + start, p->dests, p->nedges * sizeof(*p->dests)) == 0;
+}
+
+static void
+grow_table(dawg_builder *b)
+{
+	size_t slot, mask;
+	uint32_t id;
+
+	b->table_size *= 2;
+	free(b->table);
+	b->table = calloc(b->table_size, sizeof(*b->table));
+	if (b->table == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	mask = b->table_size - 1;
+	for (id = 0; id < b->d->nnodes; id++) {
+		slot = hash_node(b, id) & mask;
+		while (b->table[slot] != 0)
+			slot = (slot + 1) & mask;
+		b->table[slot] = id + 1;
+	}
+}
+
+/*
+ * Appends p to the automaton as a new node and returns its id. The
+ * perfect hash rank of every edge is the number of words that sort
+ * before the ones reachable through it from this node.
+ */
+static uint32_t
+append_node(dawg_builder *b, const dawg_pending *p)
+{
+	dawg_t *d = b->d;
+	uint32_t id = d->nnodes;
+	uint32_t rank = p->final != 0;
+	size_t i;
+
+	if (id >= DAWG_FINAL - 1)
+		errx(EXIT_FAILURE, "dawg: too many nodes");
+	if (id == b->nodes_size) {
+		b->nodes_size *= 2;
+		d->first_edge = xrealloc(d->first_edge, b->nodes_size + 1,
+		    sizeof(*d->first_edge));
+		b->nwords = xrealloc(b->nwords, b->nodes_size, sizeof(*b->nwords));
+	}
+	while (d->nedges + p->nedges > b->edges_size) {
+		b->edges_size *= 2;
+		d->labels = xrealloc(d->labels, b->edges_size, sizeof(*d->labels));
+		d->dests = xrealloc(d->dests, b->edges_size, sizeof(*d->dests));
+		d->ranks = xrealloc(d->ranks, b->edges_size, sizeof(*d->ranks));
+	}
+
+	d->first_edge[id] = d->nedges | (p->final ? DAWG_FINAL : 0);
+	for (i = 0; i < p->nedges; i++) {
+		d->labels[d->nedges] = p->labels[i];
+		d->dests[d->nedges] = p->dests[i];
+		d->ranks[d->nedges] = rank;
+		rank += b->nwords[p->dests[i]];
+		d->nedges++;
+	}
+	b->nwords[id] = rank;
+	d->nnodes++;
+	return id;
+}
+
+/*
+ * Returns the id of the node equivalent to p, adding it to the register
+ * if there is none yet. This is where common suffixes get merged.
+ */
+static uint32_t
+replace_or_register(dawg_builder *b, const dawg_pending *p)
+{
+	size_t mask = b->table_size - 1;
+	size_t slot;
+	uint32_t id;
+
+	slot = hash_edges(p->final, p->labels, p->dests, p->nedges) & mask;
+	while (b->table[slot] != 0) {
+		id = b->table[slot] - 1;
+		if (same_node(b, id, p))
+			return id;
+		slot = (slot + 1) & mask;
+	}
+	id = append_node(b, p);
+	b->table[slot] = id + 1;
+	if (++b->table_used * 2 > b->table_size)
+		grow_table(b);
+	return id;
+}
+
+/*
+ * Closes the nodes below depth ``depth'' on the path of the last word,
+ * deepest first, and points their parents at the registered nodes.
+ */
+static void
+minimize(dawg_builder *b, size_t from, size_t depth)
+{
+	dawg_pending *parent;
+	size_t i;
+
+	for (i = from; i > depth; i--) {
+		parent = &b->levels[i - 1];
+		parent->dests[parent->nedges - 1] =
+		    replace_or_register(b, &b->levels[i]);
+	}
+}
+
+/*
+ * dawg_build--
+ *  Builds a minimal automaton for keys, which must be sorted with
+ *  strcmp(3) and unique, using the incremental algorithm of Daciuk et al.
+ *  values[i] is the frequency of keys[i]. Returns NULL if the keys are
+ *  not in order.
+ */
+dawg_t *
+dawg_build(char **keys, const size_t *values, size_t n)
+{
+	dawg_builder b;
+	dawg_t *d;
+	const unsigned char *key;
+	const unsigned char *prev = (const unsigned char *) "";
+	size_t prevlen = 0, len, common, i, j;
+
+	if (n >= DAWG_FINAL)
+		return NULL;
+
+	d = calloc(1, sizeof(*d));
+	if (d == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	memset(&b, 0, sizeof(b));
+	b.d = d;
+	b.nodes_size = 1024;
+	b.edges_size = 1024;
+	b.table_size = 1024;
+	b.nlevels = 64;
+	d->first_edge = xrealloc(NULL, b.nodes_size + 1, sizeof(*d->first_edge));
+	d->labels = xrealloc(NULL, b.edges_size, sizeof(*d->labels));
+	d->dests = xrealloc(NULL, b.edges_size, sizeof(*d->dests));
+	d->ranks = xrealloc(NULL, b.edges_size, sizeof(*d->ranks));
+	d->counts = xrealloc(NULL, n ? n : 1, sizeof(*d->counts));
+	b.nwords = xrealloc(NULL, b.nodes_size, sizeof(*b.nwords));
+	b.levels = xrealloc(NULL, b.nlevels, sizeof(*b.levels));
+	b.table = calloc(b.table_size, sizeof(*b.table));
+	if (b.table == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	b.levels[0].nedges = 0;
+	b.levels[0].final = 0;
+
+	for (i = 0; i < n; i++) {
+		key = (const unsigned char *) keys[i];
+		len = strlen(keys[i]);
+		if (len == 0)
+			continue;
+
+		for (common = 0; common < len && common < prevlen; common++)
+			if (key[common] != prev[common])
+				break;
+		if (d->nwords > 0 && (common == len ||
+		    (common < prevlen && key[common] < prev[common]))) {
+			warnx("dawg: keys are not sorted or not unique at %s",
+			    keys[i]);
+			free(b.nwords);
+			free(b.levels);
+			free(b.table);
+			dawg_destroy(d);
+			return NULL;
+		}
+
+		if (len + 1 > b.nlevels) {
+			while (len + 1 > b.nlevels)
+				b.nlevels *= 2;
+			b.levels = xrealloc(b.levels, b.nlevels, sizeof(*b.levels));
+		}
+
+		minimize(&b, prevlen, common);
+		for (j = common; j < len; j++) {
+			b.levels[j].labels[b.levels[j].nedges++] = key[j];
+			b.levels[j + 1].nedges = 0;
+			b.levels[j + 1].final = 0;
+		}
+		b.levels[len].final = 1;
+		d->counts[d->nwords++] = values[i] > UINT32_MAX ?
+		    UINT32_MAX : values[i];
+		prev = key;
+		prevlen = len;
+	}
+	minimize(&b, prevlen, 0);
+	d->root = replace_or_register(&b, &b.levels[0]);
+	d->first_edge[d->nnodes] = d->nedges;
+
+	free(b.nwords);
+	free(b.levels);
+	free(b.table);
+
+	/* Give back the slack of the doubling above */
+	d->first_edge = xrealloc(d->first_edge, d->nnodes + 1,
+	    sizeof(*d->first_edge));
+	if (d->nedges > 0) {
+		d->labels = xrealloc(d->labels, d->nedges, sizeof(*d->labels));
+		d->dests = xrealloc(d->dests, d->nedges, sizeof(*d->dests));
+		d->ranks = xrealloc(d->ranks, d->nedges, sizeof(*d->ranks));
+	}
+	if (d->nwords > 0)
+		d->counts = xrealloc(d->counts, d->nwords, sizeof(*d->counts));
+	return d;
+}
+
+/*
+ * Follows the edge labelled c out of node, adding the rank of the edge
+ * to *idx. Returns 0 if there is no such edge.
+ */
+static int
+dawg_step(const dawg_t *d, uint32_t *node, unsigned char c, uint32_t *idx)
+{
+	uint32_t e = EDGE_START(d, *node);
+	uint32_t end = EDGE_START(d, *node + 1);
+
+	while (e < end && d->labels[e] < c)
+		e++;
+	if (e == end || d->labels[e] != c)
+		return 0;
+	*idx += d->ranks[e];
+	*node = d->dests[e];
+	return 1;
+}
+
+size_t
+dawg_get(const dawg_t *d, const char *key)
+{
+	const unsigned char *k = (const unsigned char *) key;
+	uint32_t node, idx = 0;
+
+	if (d == NULL || *k == 0)
+		return 0;
+
+	node = d->root;
+	for (; *k; k++)
+		if (!dawg_step(d, &node, *k, &idx))
+			return 0;
+
+	if ((d->first_edge[node] & DAWG_FINAL) == 0)
+		return 0;
+	return d->counts[idx];
+}
+
+/*
+ * dawg_prefix_len--
+ *  Returns the length of the longest prefix of key that some word of the
+ *  dawg starts with. Every node is on the way to a final one, so that is
+ *  just how far key can be followed from the root.
+ */
+size_t
+dawg_prefix_len(const dawg_t *d, const char *key)
+{
+	const unsigned char *k = (const unsigned char *) key;
+	uint32_t node, idx = 0;
+	size_t len = 0;
+
+	if (d == NULL)
+		return 0;
+
+	node = d->root;
+	while (k[len] != 0 && dawg_step(d, &node, k[len], &idx))
+		len++;
+	return len;
+}
+
+typedef struct dawg_words {
+	char **list;
+	size_t n;
+	size_t size;
+	char *buf;
+	size_t bufsize;
+} dawg_words;
+
+static void
+dawg_collect(const dawg_t *d, uint32_t node, size_t len, dawg_words *w)
+{
+	uint32_t e, end;
+
+	if (len + 2 > w->bufsize) {
+		w->bufsize = (len + 2) * 2;
+		w->buf = xrealloc(w->buf, w->bufsize, 1);
+	}
+	if (d->first_edge[node] & DAWG_FINAL) {
+		if (w->n + 1 == w->size) {
+			w->size *= 2;
+			w->list = xrealloc(w->list, w->size, sizeof(*w->list));
+		}
+		w->buf[len] = 0;
+		w->list[w->n++] = strdup(w->buf);
+	}
+
+	end = EDGE_START(d, node + 1);
+	for (e = EDGE_START(d, node); e < end; e++) {
+		w->buf[len] = d->labels[e];
+		dawg_collect(d, d->dests[e], len + 1, w);
+	}
+}
+
+/*
+ * Returns the NULL terminated list of words starting with prefix, in
+ * sorted order, or NULL if there are none.
+ */
+char **
+dawg_prefix_matches(const dawg_t *d, const char *prefix)
+{
+	dawg_words w;
+	uint32_t node, idx = 0;
+	const unsigned char *p = (const unsigned char *) prefix;
+
+	if (d == NULL || prefix == NULL || *p == 0)
+		return NULL;
+
+	node = d->root;
+	for (; *p; p++)
+		if (!dawg_step(d, &node, *p, &idx))
+			return NULL;
+
+	w.n = 0;
+	w.size = 16;
+	w.list = xrealloc(NULL, w.size, sizeof(*w.list));
+	w.bufsize = strlen(prefix) + 16;
+	w.buf = xrealloc(NULL, w.bufsize, 1);
+	memcpy(w.buf, prefix, strlen(prefix));
+	dawg_collect(d, node, strlen(prefix), &w);
+	free(w.buf);
+	w.list[w.n] = NULL;
+	return w.list;
+}
+
+void
+dawg_destroy(dawg_t *d)
+{
+	if (d == NULL)
+		return;
+	free(d->first_edge);
+	free(d->labels);
+	free(d->dests);
+	free(d->ranks);
+	free(d->counts);
+	free(d);
+}
@@ -0,0 +1,66 @@
+/*-
+ * Copyright (c) 2017 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef DAWG_H
+#define DAWG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A minimized acyclic automaton (DAWG) over a fixed set of words. Nodes
+ * are shared for common suffixes as well as prefixes, and the transitions
+ * carry perfect hash numbers so that every accepted word maps to its rank
+ * in the sorted word list, which indexes the frequency array.
+ *
+ * The edges of node i are [first_edge[i], first_edge[i + 1]) in the
+ * labels, dests and ranks arrays, sorted by label. The top bit of
+ * first_edge marks a final node.
+ */
+#define DAWG_FINAL 0x80000000U
+
+typedef struct dawg_t {
+	uint32_t *first_edge;
+	unsigned char *labels;
+	uint32_t *dests;
+	uint32_t *ranks;
+	uint32_t *counts;
+	uint32_t nnodes;
+	uint32_t nedges;
+	uint32_t nwords;
+	uint32_t root;
+} dawg_t;
+
+dawg_t *dawg_build(char **, const size_t *, size_t);
+size_t dawg_get(const dawg_t *, const char *);
+size_t dawg_prefix_len(const dawg_t *, const char *);
+char **dawg_prefix_matches(const dawg_t *, const char *);
+void dawg_destroy(dawg_t *);
+
+#endif
@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dawg.h"
+#include "test_util.h"
+#include "trie.h"
+
+/*
+ * Every third word also comes with an "ing" ending, so that many words
+ * share their suffix and the automaton has states to merge.
+ */
+static size_t
+make_words(char words[][20], char **sorted, size_t *counts)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < NWORDS; i++) {
+		make_word(i, words[n]);
+		sorted[n] = words[n];
+		n++;
+		if (i % 3 == 0) {
+			make_word(i, words[n]);
+			strcat(words[n], "ing");
+			sorted[n] = words[n];
+			n++;
+		}
+	}
+	qsort(sorted, n, sizeof(*sorted), compare_words);
+	for (i = 0; i < n; i++)
+		counts[i] = i + 1;
+	return n;
+}
+
+/* Both hold the same words, so they must give the same prefix matches */
+static int
+same_matches(trie_t *t, const dawg_t *d, const char *prefix)
+{
+	return same_words(get_prefix_matches(t, prefix),
+	    dawg_prefix_matches(d, prefix));
+}
+
+int
+main(int argc, char **argv)
+{
+	static char words[2 * NWORDS][20];
+	static char *sorted[2 * NWORDS];
+	static size_t counts[2 * NWORDS];
+	const char *probes[] = { "zzzz", "aing", "ingx", "abcdefg", "b" };
+	char prefix[20];
+	trie_t *t = trie_init();
+	dawg_t *d;
+	size_t i, j, n, bad;
+
+	n = make_words(words, sorted, counts);
+	trie_bulk_insert(&t, sorted, counts, n);
+	d = dawg_build(sorted, counts, n);
+	check(d != NULL, "dawg_build");
+	if (d == NULL)
+		return 1;
+
+	bad = 0;
+	for (i = 0; i < n; i++)
+		if (dawg_get(d, sorted[i]) != trie_get(t, sorted[i]))
+			bad++;
+	check(bad == 0, "lookup: every word agrees with the trie");
+	bad = 0;
+	for (i = 0; i < sizeof(probes) / sizeof(probes[0]); i++)
+		if (dawg_get(d, probes[i]) != trie_get(t, probes[i]) ||
+		    dawg_prefix_len(d, probes[i]) !=
+		    trie_prefix_len(t, probes[i]))
+			bad++;
+	check(bad == 0, "lookup: absent words and prefix lengths");
+
+	/* Every prefix of every 37th word, and the prefix cut one short */
+	bad = 0;
+	for (i = 0; i < n; i += 37)
+		for (j = 1; j <= strlen(sorted[i]); j++) {
+			memcpy(prefix, sorted[i], j);
+			prefix[j] = 0;
+			if (!same_matches(t, d, prefix))
+				bad++;
+		}
+	for (i = 0; i < sizeof(probes) / sizeof(probes[0]); i++)
+		if (!same_matches(t, d, probes[i]))
+			bad++;
+	check(bad == 0, "prefix: matches agree with the trie");
+
+	/* Keys out of order are refused */
+	sorted[0] = words[1];
+	sorted[1] = words[0];
+	check(dawg_build(sorted, counts, 2) == NULL,
+	    "dawg_build: unsorted keys");
+
+	dawg_destroy(d);
+	trie_destroy(t);
+	return test_result();
+}
@@ -48,9 +48,25 @@ static void
 usage(void)
 {
 	fprintf(stderr, "dictionary [-i input] [-n ngram] [-o output]\n");
+	fprintf(stderr, "dictionary -m image [-i unigrams] [-w whitelist]\n");
 	exit(1);
 }
 
+/*
+ * Loads the unigram dictionary the way spell_init does and saves it as
+ * a precompiled image which spell_open_image can map directly.
+ */
+static void
+compile_image(const char *unigrams, const char *whitelist, const char *image)
+{
+	spell_t *spell = spell_init(unigrams, whitelist);
+	if (spell == NULL)
+		errx(EXIT_FAILURE, "Failed to load %s", unigrams);
+	if (spell_write_image(spell, image) < 0)
+		errx(EXIT_FAILURE, "Failed to write %s", image);
+	spell_destroy(spell);
+}
+
 static void
 parse_file(FILE * f, FILE * output, long ngram)
 {
@@ -202,15 +218,19 @@ main(int argc, char **argv)
 {
 	FILE *inputfile = stdin;
 	FILE *outputfile = stdout;
+	const char *inputpath = NULL;
+	const char *imagepath = NULL;
+	const char *whitelist_filepath = NULL;
 	long ngram = 1;
 	int ch;
 
-	while ((ch = getopt(argc, argv, "i:n:o:")) != -1) {
+	while ((ch = getopt(argc, argv, "i:m:n:o:w:")) != -1) {
 		switch (ch) {
 		case 'i':
-			inputfile = fopen(optarg, "r");
-			if (inputfile == NULL)
-				err(EXIT_FAILURE, "Failed to open %s", optarg);
+			inputpath = optarg;
+			break;
+		case 'm':
+			imagepath = optarg;
 			break;
 		case 'n':
 			ngram = strtol(optarg, NULL, 10);
@@ -220,11 +240,26 @@ main(int argc, char **argv)
 			if (outputfile == NULL)
 				err(EXIT_FAILURE, "Failed to open %s for writing", optarg);
 			break;
+		case 'w':
+			whitelist_filepath = optarg;
+			break;
 		default:
 			usage();
 			break;
 		}
 	}
+
+	if (imagepath != NULL) {
+		compile_image(inputpath ? inputpath : "dict/unigram.txt",
+		    whitelist_filepath, imagepath);
+		return 0;
+	}
+
+	if (inputpath != NULL) {
+		inputfile = fopen(inputpath, "r");
+		if (inputfile == NULL)
+			err(EXIT_FAILURE, "Failed to open %s", inputpath);
+	}
 	parse_file(inputfile, outputfile, ngram);
 	if (inputfile != stdin)
 		fclose(inputfile);
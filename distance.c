@@ -0,0 +1,497 @@
+/*-
+ * Copyright (c) 2017 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL
+#endif
+
+#include "distance.h"
+
+#define WORD_BITS 64
+
+/*
+ * levenshtein_distance_batch scores the query against several candidates
+ * at once, one candidate per 32 bit lane of a vector
+ */
+#define LANE_BITS	32
+#define MAX_LANES	8
+
+/*
+ * Sets peq[c] to the positions of c in a, for the characters of a and b,
+ * the only ones looked up. The rest of peq is left alone, which saves
+ * clearing the whole table for every pair of short strings.
+ */
+static void
+fill_peq(uint64_t *peq, const unsigned char *a, size_t la,
+    const unsigned char *b, size_t lb)
+{
+	size_t i;
+
+	for (i = 0; i < la; i++)
+		peq[a[i]] = 0;
+	for (i = 0; i < lb; i++)
+		peq[b[i]] = 0;
+	for (i = 0; i < la; i++)
+		peq[a[i]] |= (uint64_t) 1 << i;
+}
+
+/*
+ * Gives up on a pair once its distance is sure to exceed k: the last row
+ * of the matrix loses at most one per column left after column j.
+ */
+#define HOPELESS(score, k, lb, j) \
+	((score) > (k) && (score) - (k) > (lb) - (j) - 1)
+
+/*
+ * Levenshtein distance for 1 <= la <= 64, a single word per column, or
+ * k + 1 if it exceeds k
+ */
+static size_t
+myers_word(const unsigned char *a, size_t la, const unsigned char *b, size_t lb,
+    size_t k)
+{
+	uint64_t peq[UCHAR_MAX + 1];
+	uint64_t pv = ~(uint64_t) 0, mv = 0, eq, xv, xh, ph, mh;
+	uint64_t last = (uint64_t) 1 << (la - 1);
+	size_t score = la, j;
+
+	fill_peq(peq, a, la, b, lb);
+	for (j = 0; j < lb; j++) {
+		eq = peq[b[j]];
+		xv = eq | mv;
+		xh = (((eq & pv) + pv) ^ pv) | eq;
+		ph = mv | ~(xh | pv);
+		mh = pv & xh;
+		if (ph & last)
+			score++;
+		else if (mh & last)
+			score--;
+		if (HOPELESS(score, k, lb, j))
+			return k + 1;
+		/* The first row of the matrix grows by one per column */
+		ph = ph << 1 | 1;
+		mh <<= 1;
+		pv = mh | ~(xv | ph);
+		mv = ph & xv;
+	}
+	return score;
+}
+
+/*
+ * Levenshtein distance for la > 64. The column is cut into blocks of 64
+ * rows, each handing the horizontal difference of its last row down to
+ * the next one.
+ */
+static size_t
+myers_blocks(const unsigned char *a, size_t la, const unsigned char *b, size_t lb)
+{
+	size_t nblocks = (la + WORD_BITS - 1) / WORD_BITS;
+	uint64_t *peq, *pv, *mv;
+	uint64_t eq, xv, xh, ph, mh, hneg;
+	uint64_t last = (uint64_t) 1 << ((la - 1) % WORD_BITS);
+	size_t score = la, i, j, w;
+	int hin, hout;
+
+	peq = calloc(nblocks * (UCHAR_MAX + 1), sizeof(*peq));
+	pv = malloc(nblocks * sizeof(*pv));
+	mv = calloc(nblocks, sizeof(*mv));
+	if (peq == NULL || pv == NULL || mv == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	for (i = 0; i < la; i++)
+		peq[(i / WORD_BITS) * (UCHAR_MAX + 1) + a[i]] |=
+		    (uint64_t) 1 << (i % WORD_BITS);
+	for (w = 0; w < nblocks; w++)
+		pv[w] = ~(uint64_t) 0;
+
+	for (j = 0; j < lb; j++) {
+		hin = 1;
+		for (w = 0; w < nblocks; w++) {
+			eq = peq[w * (UCHAR_MAX + 1) + b[j]];
+			hneg = hin < 0;
+			xv = eq | mv[w];
+			eq |= hneg;
+			xh = (((eq & pv[w]) + pv[w]) ^ pv[w]) | eq;
+			ph = mv[w] | ~(xh | pv[w]);
+			mh = pv[w] & xh;
+			if (w == nblocks - 1) {
+				if (ph & last)
+					score++;
+				else if (mh & last)
+					score--;
+			}
+			hout = (int) (ph >> (WORD_BITS - 1)) - (int) (mh >> (WORD_BITS - 1));
+			ph = ph << 1 | (hin > 0);
+			mh = mh << 1 | hneg;
+			pv[w] = mh | ~(xv | ph);
+			mv[w] = ph & xv;
+			hin = hout;
+		}
+	}
+	free(peq);
+	free(pv);
+	free(mv);
+	return score;
+}
+
+size_t
+levenshtein_distance(const char *s1, size_t len1, const char *s2, size_t len2)
+{
+	const unsigned char *a = (const unsigned char *) s1;
+	const unsigned char *b = (const unsigned char *) s2;
+
+	if (len1 == 0)
+		return len2;
+	if (len1 <= WORD_BITS)
+		return myers_word(a, len1, b, len2, SIZE_MAX);
+	/* The shorter string makes for fewer blocks */
+	if (len2 < len1)
+		return levenshtein_distance(s2, len2, s1, len1);
+	return myers_blocks(a, len1, b, len2);
+}
+
+/*
+ * Optimal string alignment distance for 1 <= la <= 64, or k + 1 if it
+ * exceeds k. On top of Myers' step, a diagonal zero difference also comes
+ * from a transposition of b[j - 1] and b[j], found from the match vectors
+ * of both characters.
+ */
+static size_t
+hyyro_word(const unsigned char *a, size_t la, const unsigned char *b, size_t lb,
+    size_t k)
+{
+	uint64_t peq[UCHAR_MAX + 1];
+	uint64_t pv = ~(uint64_t) 0, mv = 0, d0 = 0, eq, preveq = 0, tr, hp, hn;
+	uint64_t last = (uint64_t) 1 << (la - 1);
+	size_t score = la, j;
+
+	fill_peq(peq, a, la, b, lb);
+	for (j = 0; j < lb; j++) {
+		eq = peq[b[j]];
+		tr = (((~d0) & eq) << 1) & preveq;
+		d0 = (((eq & pv) + pv) ^ pv) | eq | mv | tr;
+		hp = mv | ~(d0 | pv);
+		hn = d0 & pv;
+		if (hp & last)
+			score++;
+		else if (hn & last)
+			score--;
+		if (HOPELESS(score, k, lb, j))
+			return k + 1;
+		hp = hp << 1 | 1;
+		hn <<= 1;
+		pv = hn | ~(d0 | hp);
+		mv = hp & d0;
+		preveq = eq;
+	}
+	return score;
+}
+
+/*
+ * Distance for strings too long for a word, or k + 1 if it exceeds k,
+ * with the plain recurrence over three rows on the heap. Only the cells
+ * of the diagonal band |i - j| <= k can be within k, so each row is
+ * limited to those and the cells just outside it hold k + 1. transpose
+ * picks the optimal string alignment distance over Levenshtein's.
+ */
+static size_t
+banded_rows(const unsigned char *a, size_t la, const unsigned char *b,
+    size_t lb, size_t k, int transpose)
+{
+	size_t *rows, *prev2, *prev, *cur, *tmp;
+	size_t i, j, lo, hi, v, rowmin;
+
+	if ((rows = malloc(3 * (lb + 1) * sizeof(*rows))) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	prev2 = rows;
+	prev = rows + lb + 1;
+	cur = rows + 2 * (lb + 1);
+	for (j = 0; j <= lb; j++)
+		prev[j] = j <= k ? j : k + 1;
+	for (i = 1; i <= la; i++) {
+		lo = i > k ? i - k : 1;
+		hi = lb - i > k ? i + k : lb;
+		cur[lo - 1] = lo == 1 && i <= k ? i : k + 1;
+		rowmin = cur[lo - 1];
+		for (j = lo; j <= hi; j++) {
+			v = prev[j - 1] + (a[i - 1] != b[j - 1]);
+			if (prev[j] + 1 < v)
+				v = prev[j] + 1;
+			if (cur[j - 1] + 1 < v)
+				v = cur[j - 1] + 1;
+			if (transpose && i > 1 && j > 1 && a[i - 1] == b[j - 2] &&
+			    a[i - 2] == b[j - 1] && prev2[j - 2] + 1 < v)
+				v = prev2[j - 2] + 1;
+			cur[j] = v;
+			if (v < rowmin)
+				rowmin = v;
+		}
+		if (hi < lb)
+			cur[hi + 1] = k + 1;
+		if (rowmin > k) {
+			free(rows);
+			return k + 1;
+		}
+		tmp = prev2;
+		prev2 = prev;
+		prev = cur;
+		cur = tmp;
+	}
+	v = prev[lb];
+	free(rows);
+	return v > k ? k + 1 : v;
+}
+
+size_t
+osa_distance(const char *s1, size_t len1, const char *s2, size_t len2)
+{
+	const unsigned char *a = (const unsigned char *) s1;
+	const unsigned char *b = (const unsigned char *) s2;
+
+	if (len1 > len2)
+		return osa_distance(s2, len2, s1, len1);
+	if (len1 == 0)
+		return len2;
+	if (len1 <= WORD_BITS)
+		return hyyro_word(a, len1, b, len2, SIZE_MAX);
+	return banded_rows(a, len1, b, len2, len2, 1);
+}
+
+size_t
+levenshtein_distance_bounded(const char *s1, size_t len1, const char *s2,
+    size_t len2, size_t k)
+{
+	const unsigned char *a = (const unsigned char *) s1;
+	const unsigned char *b = (const unsigned char *) s2;
+
+	if (len1 > len2)
+		return levenshtein_distance_bounded(s2, len2, s1, len1, k);
+	if (len2 - len1 > k)
+		return k + 1;
+	if (len1 == 0)
+		return len2;
+	if (len1 <= WORD_BITS)
+		return myers_word(a, len1, b, len2, k);
+	return banded_rows(a, len1, b, len2, k, 0);
+}
+
+size_t
+osa_distance_bounded(const char *s1, size_t len1, const char *s2,
+    size_t len2, size_t k)
+{
+	const unsigned char *a = (const unsigned char *) s1;
+	const unsigned char *b = (const unsigned char *) s2;
+
+	if (len1 > len2)
+		return osa_distance_bounded(s2, len2, s1, len1, k);
+	if (len2 - len1 > k)
+		return k + 1;
+	if (len1 == 0)
+		return len2;
+	if (len1 <= WORD_BITS)
+		return hyyro_word(a, len1, b, len2, k);
+	return banded_rows(a, len1, b, len2, k, 1);
+}
+
+/*
+ * Runs Myers' step over the candidates of words side by side, each in a
+ * lane of its own, and stores their distances to the query in scores. The
+ * query, with m characters, is the pattern and words[l] has lens[l] of
+ * them; a lane with no candidate has a length of 0. A lane whose candidate
+ * has run out keeps stepping, but its score is left alone.
+ */
+#ifdef HAVE_AVX2_KERNEL
+__attribute__((target("avx2")))
+static void
+myers_lanes_avx2(const uint32_t *peq, size_t m, const unsigned char **words,
+    const uint32_t *lens, size_t maxlen, uint32_t *scores)
+{
+	uint32_t eqs[8] __attribute__((aligned(32)));
+	__m256i ones = _mm256_set1_epi32(-1), zero = _mm256_setzero_si256();
+	__m256i one = _mm256_set1_epi32(1);
+	__m256i last = _mm256_set1_epi32((int) ((uint32_t) 1 << (m - 1)));
+	__m256i lenv = _mm256_loadu_si256((const __m256i *) lens);
+	__m256i pv = ones, mv = zero, score = _mm256_set1_epi32((int) m);
+	__m256i eq, xv, xh, ph, mh, active, up, down;
+	size_t j, l;
+
+	for (j = 0; j < maxlen; j++) {
+		for (l = 0; l < 8; l++)
+			eqs[l] = j < lens[l] ? peq[words[l][j]] : 0;
+		eq = _mm256_load_si256((const __m256i *) eqs);
+		active = _mm256_cmpgt_epi32(lenv, _mm256_set1_epi32((int) j));
+		xv = _mm256_or_si256(eq, mv);
+		xh = _mm256_or_si256(_mm256_xor_si256(_mm256_add_epi32(
+		    _mm256_and_si256(eq, pv), pv), pv), eq);
+		ph = _mm256_or_si256(mv,
+		    _mm256_xor_si256(_mm256_or_si256(xh, pv), ones));
+		mh = _mm256_and_si256(pv, xh);
+		/* All ones, that is -1, in the lanes where the score moves */
+		up = _mm256_andnot_si256(_mm256_cmpeq_epi32(
+		    _mm256_and_si256(ph, last), zero), active);
+		down = _mm256_andnot_si256(_mm256_cmpeq_epi32(
+		    _mm256_and_si256(mh, last), zero), active);
+		score = _mm256_add_epi32(_mm256_sub_epi32(score, up), down);
+		ph = _mm256_or_si256(_mm256_slli_epi32(ph, 1), one);
+		mh = _mm256_slli_epi32(mh, 1);
+		pv = _mm256_or_si256(mh,
+		    _mm256_xor_si256(_mm256_or_si256(xv, ph), ones));
+		mv = _mm256_and_si256(ph, xv);
+	}
+	_mm256_storeu_si256((__m256i *) scores, score);
+}
+#endif
+
+#ifdef __SSE2__
+static void
+myers_lanes_sse2(const uint32_t *peq, size_t m, const unsigned char **words,
+    const uint32_t *lens, size_t maxlen, uint32_t *scores)
+{
+	uint32_t eqs[4] __attribute__((aligned(16)));
+	__m128i ones = _mm_set1_epi32(-1), zero = _mm_setzero_si128();
+	__m128i one = _mm_set1_epi32(1);
+	__m128i last = _mm_set1_epi32((int) ((uint32_t) 1 << (m - 1)));
+	__m128i lenv = _mm_loadu_si128((const __m128i *) lens);
+	__m128i pv = ones, mv = zero, score = _mm_set1_epi32((int) m);
+	__m128i eq, xv, xh, ph, mh, active, up, down;
+	size_t j, l;
+
+	for (j = 0; j < maxlen; j++) {
+		for (l = 0; l < 4; l++)
+			eqs[l] = j < lens[l] ? peq[words[l][j]] : 0;
+		eq = _mm_load_si128((const __m128i *) eqs);
+		active = _mm_cmpgt_epi32(lenv, _mm_set1_epi32((int) j));
+		xv = _mm_or_si128(eq, mv);
+		xh = _mm_or_si128(_mm_xor_si128(_mm_add_epi32(
+		    _mm_and_si128(eq, pv), pv), pv), eq);
+		ph = _mm_or_si128(mv, _mm_xor_si128(_mm_or_si128(xh, pv), ones));
+		mh = _mm_and_si128(pv, xh);
+		up = _mm_andnot_si128(_mm_cmpeq_epi32(
+		    _mm_and_si128(ph, last), zero), active);
+		down = _mm_andnot_si128(_mm_cmpeq_epi32(
+		    _mm_and_si128(mh, last), zero), active);
+		score = _mm_add_epi32(_mm_sub_epi32(score, up), down);
+		ph = _mm_or_si128(_mm_slli_epi32(ph, 1), one);
+		mh = _mm_slli_epi32(mh, 1);
+		pv = _mm_or_si128(mh, _mm_xor_si128(_mm_or_si128(xv, ph), ones));
+		mv = _mm_and_si128(ph, xv);
+	}
+	_mm_storeu_si128((__m128i *) scores, score);
+}
+#endif
+
+typedef void (*lanes_kernel)(const uint32_t *, size_t, const unsigned char **,
+    const uint32_t *, size_t, uint32_t *);
+
+/*
+ * Picks the widest kernel the CPU runs with at most maxlanes lanes,
+ * setting *nlanes to the number of candidates it takes at a time, or
+ * returns NULL if there is none.
+ */
+static lanes_kernel
+get_lanes_kernel(size_t maxlanes, size_t *nlanes)
+{
+#ifdef HAVE_AVX2_KERNEL
+	if (maxlanes >= 8 && __builtin_cpu_supports("avx2")) {
+		*nlanes = 8;
+		return myers_lanes_avx2;
+	}
+#endif
+#ifdef __SSE2__
+	if (maxlanes >= 4) {
+		*nlanes = 4;
+		return myers_lanes_sse2;
+	}
+#endif
+	*nlanes = 0;
+	return NULL;
+}
+
+void
+levenshtein_distance_batch(const char *query, size_t qlen,
+    char * const *words, size_t n, size_t k, size_t *distances)
+{
+	levenshtein_distance_batch_lanes(query, qlen, words, n, k, distances,
+	    MAX_LANES);
+}
+
+void
+levenshtein_distance_batch_lanes(const char *query, size_t qlen,
+    char * const *words, size_t n, size_t k, size_t *distances,
+    size_t maxlanes)
+{
+	uint32_t peq[UCHAR_MAX + 1];
+	const unsigned char *lane_words[MAX_LANES];
+	uint32_t lens[MAX_LANES], scores[MAX_LANES];
+	size_t lane_index[MAX_LANES];
+	size_t i, l, len, nlanes, used = 0, maxlen = 0;
+	lanes_kernel kernel;
+
+	kernel = get_lanes_kernel(maxlanes, &nlanes);
+	if (kernel == NULL || qlen == 0 || qlen > LANE_BITS) {
+		for (i = 0; i < n; i++)
+			distances[i] = levenshtein_distance_bounded(query, qlen,
+			    words[i], strlen(words[i]), k);
+		return;
+	}
+
+	memset(peq, 0, sizeof(peq));
+	for (i = 0; i < qlen; i++)
+		peq[(unsigned char) query[i]] |= (uint32_t) 1 << i;
+	for (i = 0; i <= n; i++) {
+		if (i < n) {
+			len = strlen(words[i]);
+			if ((len > qlen ? len - qlen : qlen - len) > k) {
+				distances[i] = k + 1;
+				continue;
+			}
+			lane_words[used] = (const unsigned char *) words[i];
+			lens[used] = len;
+			lane_index[used++] = i;
+			if (len > maxlen)
+				maxlen = len;
+			if (used < nlanes)
+				continue;
+		}
+		if (used == 0)
+			break;
+		for (l = used; l < nlanes; l++)
+			lens[l] = 0;
+		kernel(peq, qlen, lane_words, lens, maxlen, scores);
+		for (l = 0; l < used; l++)
+			distances[lane_index[l]] = scores[l] > k ? k + 1 : scores[l];
+		used = 0;
+		maxlen = 0;
+	}
+}
@@ -0,0 +1,72 @@
+/*-
+ * Copyright (c) 2017 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef DISTANCE_H
+#define DISTANCE_H
+
+#include <stddef.h>
+
+/*
+ * Edit distances computed with the bit-parallel algorithm of Myers, as
+ * reformulated by Hyyrö: a column of the dynamic programming matrix is
+ * kept as bit vectors of its vertical differences, one bit per character
+ * of the first string, and advanced over a character of the second string
+ * in a handful of word operations. The strings are given with their
+ * lengths and need not be NUL terminated.
+ *
+ * levenshtein_distance counts insertions, deletions and substitutions.
+ * osa_distance also counts a transposition of two adjacent characters as
+ * a single edit, the optimal string alignment flavour of the Damerau
+ * distance where no substring is edited twice.
+ *
+ * The _bounded versions return the distance if it is at most their last
+ * argument k, and k + 1 otherwise. They only look at the band of the
+ * matrix within k of its diagonal and stop as soon as the distance is
+ * known to exceed k, which makes rejecting a distant pair cheap.
+ *
+ * levenshtein_distance_batch stores in distances[i] the bounded
+ * Levenshtein distance between the query and the NUL terminated words[i],
+ * for the n words. Where the CPU has vector instructions, it runs the
+ * bit-parallel algorithm on several words at once, one per lane.
+ * levenshtein_distance_batch_lanes does the same with at most maxlanes
+ * lanes, 0 scoring the words one by one, so that the narrower kernels can
+ * be run on a CPU with a wider one.
+ */
+size_t levenshtein_distance(const char *, size_t, const char *, size_t);
+size_t levenshtein_distance_bounded(const char *, size_t, const char *, size_t,
+    size_t);
+void levenshtein_distance_batch(const char *, size_t, char * const *, size_t,
+    size_t, size_t *);
+void levenshtein_distance_batch_lanes(const char *, size_t, char * const *,
+    size_t, size_t, size_t *, size_t);
+size_t osa_distance(const char *, size_t, const char *, size_t);
+size_t osa_distance_bounded(const char *, size_t, const char *, size_t,
+    size_t);
+
+#endif
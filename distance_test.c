@@ -0,0 +1,316 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "distance.h"
+#include "test_util.h"
+
+/* Long enough for two blocks of 64 characters */
+#define MAX_LEN 70
+
+/* A fixed sequence of pseudo random numbers, to repeat any failure */
+static uint32_t seed = 1;
+
+static uint32_t
+next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+/*
+ * Fills s with len characters out of the first nchars letters: with few
+ * of them the characters repeat a lot, which is what trips the carries
+ * of the bit-parallel kernels.
+ */
+static void
+random_string(char *s, size_t len, size_t nchars)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		s[i] = 'a' + next_random() % nchars;
+}
+
+/*
+ * Copies a into b with nedits random substitutions, insertions, deletions
+ * and transpositions of adjacent characters, and returns the length of b.
+ */
+static size_t
+mutate_string(const char *a, size_t la, char *b, size_t nedits)
+{
+	size_t lb = la, i, pos;
+	char c;
+
+	memcpy(b, a, la);
+	for (i = 0; i < nedits; i++) {
+		pos = lb > 0 ? next_random() % lb : 0;
+		switch (next_random() % 4) {
+		case 0:
+			if (lb > 0)
+				b[pos] = 'a' + next_random() % 4;
+			break;
+		case 1:
+			if (lb < 2 * MAX_LEN) {
+				memmove(b + pos + 1, b + pos, lb - pos);
+				b[pos] = 'a' + next_random() % 4;
+				lb++;
+			}
+			break;
+		case 2:
+			if (lb > 0) {
+				memmove(b + pos, b + pos + 1, lb - pos - 1);
+				lb--;
+			}
+			break;
+		default:
+			if (pos + 1 < lb) {
+				c = b[pos];
+				b[pos] = b[pos + 1];
+				b[pos + 1] = c;
+			}
+			break;
+		}
+	}
+	return lb;
+}
+
+/*
+ * The textbook dynamic programming matrix, with the optimal string
+ * alignment transposition if transpose is set
+ */
+static size_t
+matrix_distance(const char *a, size_t la, const char *b, size_t lb,
+    int transpose)
+{
+	size_t *d = malloc((la + 1) * (lb + 1) * sizeof(*d));
+	size_t i, j, v, cost;
+
+#define D(i, j) d[(i) * (lb + 1) + (j)]
+	if (d == NULL) {
+		printf("malloc failed\n");
+		exit(1);
+	}
+	for (i = 0; i <= la; i++)
+		D(i, 0) = i;
+	for (j = 0; j <= lb; j++)
+		D(0, j) = j;
+	for (i = 1; i <= la; i++)
+		for (j = 1; j <= lb; j++) {
+			cost = a[i - 1] != b[j - 1];
+			v = D(i - 1, j - 1) + cost;
+			if (D(i - 1, j) + 1 < v)
+				v = D(i - 1, j) + 1;
+			if (D(i, j - 1) + 1 < v)
+				v = D(i, j - 1) + 1;
+			if (transpose && i > 1 && j > 1 && a[i - 1] == b[j - 2] &&
+			    a[i - 2] == b[j - 1] && D(i - 2, j - 2) + 1 < v)
+				v = D(i - 2, j - 2) + 1;
+			D(i, j) = v;
+		}
+	v = D(la, lb);
+#undef D
+	free(d);
+	return v;
+}
+
+/* Both kernels agree with the matrix on a and b, either way round */
+static int
+same_distances(const char *a, size_t la, const char *b, size_t lb)
+{
+	size_t lev = matrix_distance(a, la, b, lb, 0);
+	size_t osa = matrix_distance(a, la, b, lb, 1);
+
+	return levenshtein_distance(a, la, b, lb) == lev &&
+	    levenshtein_distance(b, lb, a, la) == lev &&
+	    osa_distance(a, la, b, lb) == osa &&
+	    osa_distance(b, lb, a, la) == osa;
+}
+
+/*
+ * The bounded kernels give the distance if it is at most k and k + 1
+ * otherwise, for each of the limits
+ */
+static int
+same_bounded(const char *a, size_t la, const char *b, size_t lb)
+{
+	const size_t limits[] = { 0, 1, 2, 6 };
+	size_t lev = matrix_distance(a, la, b, lb, 0);
+	size_t osa = matrix_distance(a, la, b, lb, 1);
+	size_t i, k;
+
+	for (i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+		k = limits[i];
+		if (levenshtein_distance_bounded(a, la, b, lb, k) !=
+		    (lev <= k ? lev : k + 1) ||
+		    levenshtein_distance_bounded(b, lb, a, la, k) !=
+		    (lev <= k ? lev : k + 1) ||
+		    osa_distance_bounded(a, la, b, lb, k) !=
+		    (osa <= k ? osa : k + 1) ||
+		    osa_distance_bounded(b, lb, a, la, k) !=
+		    (osa <= k ? osa : k + 1))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Every pair of lengths up to MAX_LEN, which crosses the 64 character
+ * block boundary, with unrelated strings over 2 and 4 letters and with
+ * strings a few edits apart
+ */
+static void
+test_distances(void)
+{
+	char a[2 * MAX_LEN], b[2 * MAX_LEN];
+	size_t la, lb, nchars, bad = 0, badnear = 0;
+
+	for (la = 0; la <= MAX_LEN; la++)
+		for (lb = 0; lb <= MAX_LEN; lb++)
+			for (nchars = 2; nchars <= 4; nchars += 2) {
+				random_string(a, la, nchars);
+				random_string(b, lb, nchars);
+				if (!same_distances(a, la, b, lb))
+					bad++;
+			}
+	check(bad == 0, "distance: unrelated strings agree with the matrix");
+
+	for (la = 0; la <= MAX_LEN; la++)
+		for (nchars = 0; nchars <= 8; nchars++) {
+			random_string(a, la, 4);
+			lb = mutate_string(a, la, b, nchars);
+			if (!same_distances(a, la, b, lb))
+				badnear++;
+		}
+	check(badnear == 0, "distance: nearby strings agree with the matrix");
+}
+
+/* Transpositions count once in the OSA distance, twice otherwise */
+static void
+test_transpositions(void)
+{
+	check(levenshtein_distance("ab", 2, "ba", 2) == 2 &&
+	    osa_distance("ab", 2, "ba", 2) == 1, "distance: ab and ba");
+	check(osa_distance("abcdef", 6, "badcfe", 6) == 3 &&
+	    levenshtein_distance("abcdef", 6, "badcfe", 6) == 4,
+	    "distance: three transpositions");
+	/* Editing the transposed characters again is not an alignment */
+	check(osa_distance("ca", 2, "abc", 3) == 3,
+	    "distance: no substring edited twice");
+	check(osa_distance("aaaa", 4, "aaaa", 4) == 0 &&
+	    levenshtein_distance("", 0, "aaa", 3) == 3,
+	    "distance: repeated characters and the empty string");
+}
+
+/*
+ * The same pairs through the bounded kernels. Past 64 characters they
+ * run the banded rows, whose band edges matter for strings within k of
+ * each other: those come from up to 8 edits on strings of every length.
+ */
+static void
+test_bounded(void)
+{
+	char a[2 * MAX_LEN], b[2 * MAX_LEN];
+	size_t la, lb, i, bad = 0, badnear = 0;
+
+	for (la = 0; la <= MAX_LEN; la++)
+		for (lb = 0; lb <= MAX_LEN; lb++) {
+			random_string(a, la, 2);
+			random_string(b, lb, 2);
+			if (!same_bounded(a, la, b, lb))
+				bad++;
+		}
+	check(bad == 0, "bounded: unrelated strings");
+
+	for (la = 0; la <= MAX_LEN; la++)
+		for (i = 0; i < 4 * 9; i++) {
+			random_string(a, la, 4);
+			lb = mutate_string(a, la, b, i % 9);
+			if (!same_bounded(a, la, b, lb))
+				badnear++;
+		}
+	check(badnear == 0, "bounded: nearby strings");
+	check(levenshtein_distance_bounded("abc", 3, "abc", 3, 0) == 0 &&
+	    levenshtein_distance_bounded("abc", 3, "abd", 3, 0) == 1 &&
+	    osa_distance_bounded("abc", 3, "bac", 3, 0) == 1 &&
+	    osa_distance_bounded("abc", 3, "bac", 3, 1) == 1,
+	    "bounded: k == 0");
+}
+
+/* Most words a batch is given, not a multiple of any lane count */
+#define MAX_BATCH 21
+
+/*
+ * Runs a batch through each kernel with each limit, counting the results
+ * which differ from the scalar distance and adding those rejected with
+ * k + 1 to *rejects
+ */
+static size_t
+bad_batch(const char *query, size_t qlen, char **list, size_t n,
+    size_t *rejects)
+{
+	const size_t limits[] = { 0, 1, 2, 6 };
+	const size_t lanes[] = { 0, 4, 8 };
+	size_t distances[MAX_BATCH];
+	size_t i, j, l, k, bad = 0;
+
+	for (j = 0; j < sizeof(limits) / sizeof(limits[0]); j++) {
+		k = limits[j];
+		for (l = 0; l < sizeof(lanes) / sizeof(lanes[0]); l++) {
+			levenshtein_distance_batch_lanes(query, qlen, list, n, k,
+			    distances, lanes[l]);
+			for (i = 0; i < n; i++) {
+				if (distances[i] != levenshtein_distance_bounded(
+				    query, qlen, list[i], strlen(list[i]), k))
+					bad++;
+				*rejects += distances[i] == k + 1;
+			}
+		}
+	}
+	return bad;
+}
+
+/*
+ * Every batch size up to MAX_BATCH through each kernel: 8 lanes when the
+ * CPU has AVX2, 4 with SSE2 and none, the scalar loop. The words are a
+ * few edits away from the query or unrelated to it, shorter ones ending
+ * early in their lane and far ones rejected with k + 1. Queries of 32 and
+ * 33 characters reach the limit of a lane and the scalar fallback.
+ */
+static void
+test_batch(void)
+{
+	static char words[MAX_BATCH][2 * MAX_LEN + 1];
+	char *list[MAX_BATCH];
+	char query[MAX_LEN];
+	size_t qlen, n, i, len, bad = 0, rejects = 0;
+
+	for (qlen = 0; qlen <= 33; qlen++)
+		for (n = 0; n <= MAX_BATCH; n++) {
+			random_string(query, qlen, 4);
+			for (i = 0; i < n; i++) {
+				if (i % 3 == 2) {
+					len = next_random() % 40;
+					random_string(words[i], len, 4);
+				} else
+					len = mutate_string(query, qlen, words[i],
+					    next_random() % 5);
+				words[i][len] = 0;
+				list[i] = words[i];
+			}
+			bad += bad_batch(query, qlen, list, n, &rejects);
+		}
+	check(bad == 0, "batch: every kernel agrees with the scalar distance");
+	check(rejects > 0, "batch: words beyond k rejected");
+}
+
+int
+main(int argc, char **argv)
+{
+	test_distances();
+	test_transpositions();
+	test_bounded();
+	test_batch();
+	return test_result();
+}
@@ -32,7 +32,10 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <err.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -46,19 +49,75 @@
 #include <sys/stat.h>
 
 #include "libspell.h"
+#include "dawg.h"
+#include "distance.h"
+#include "hash.h"
 #include "trie.h"
 
-typedef struct set {
-	char *a;
-	char *b;
-} set;
-
 typedef struct next {
 	char pri[2];
 	char sec[2];
 	size_t offset;
 } next;
 
+/*
+ * Room needed for the metaphone code of a word of len characters: every
+ * rule consumes at least one character and emits at most two.
+ */
+#define METAPHONE_CODE_SIZE(len) (2 * (len) + 10)
+
+/*
+ * Longest part of a word metaphone_code looks at, the rest of a longer
+ * word is left out of its code. This bounds the code buffers, which live
+ * on the stack: METAPHONE_CODE_MAX bytes hold the code of any string.
+ * Suggestions are only looked for words of up to TRIE_MAX_WORD bytes, so
+ * neither they, their edits nor the codes of those ever get this long.
+ */
+#define METAPHONE_MAX_WORD (4 * TRIE_MAX_WORD)
+#define METAPHONE_CODE_MAX METAPHONE_CODE_SIZE(METAPHONE_MAX_WORD)
+
+static char *metaphone_code(const char *, char *);
+static void build_alphabets(spell_t *);
+static struct spell_hot *update_hot(const struct spell_hot *, trie_t *,
+    char **, size_t);
+
+/*
+ * On-disk layout of a precompiled dictionary image, as written by
+ * spell_write_image(). The image holds the trie nodes verbatim followed by
+ * the phonetic index: a table of metaphone codes sorted with strcmp(3),
+ * each pointing at its NUL separated words in a shared string pool.
+ * Everything is in host byte order; bump SPELL_IMAGE_VERSION whenever
+ * trie_node_t or any of these structures change.
+ */
+#define SPELL_IMAGE_MAGIC "NBSPELL"
+#define SPELL_IMAGE_VERSION 2
+
+typedef struct spell_image_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t nnodes;
+	uint32_t ncodes;
+	uint32_t reserved;
+	uint64_t nodes_offset;
+	uint64_t codes_offset;
+	uint64_t strings_offset;
+	uint64_t strings_size;
+} spell_image_header;
+
+typedef struct spell_image_code {
+	uint32_t code;		/* offset of the code in the string pool */
+	uint32_t words;		/* offset of the first word of the bucket */
+	uint32_t nwords;
+} spell_image_code;
+
+struct spell_image {
+	void *base;
+	size_t size;
+	const spell_image_code *codes;
+	uint32_t ncodes;
+	const char *strings;
+};
+
 
 /*
  * Converts a word to lower case
@@ -75,17 +134,6 @@ lower(char *str)
 	return str;
 }
 
-static int
-min(int i, int j, int k)
-{
-	int min = i;
-	if (min > j)
-		min = j;
-	if (min > k)
-		min = k;
-	return min;
-}
-
 static void
 append_word_list(word_list *l1, word_list *l2)
 {
@@ -137,28 +185,7 @@ concat_lists(char **l1, char **l2)
 static int
 edit_distance(const char *s1, const char *s2)
 {
-	size_t i, j;
-	size_t len1 = strlen(s1);
-	size_t len2 = strlen(s2);
-	int m[len1 + 1][len2 + 1];
-	for (i = 0; i < len1; i++)
-		for(j = 0; j < len2; j++)
-			m[i][j] = 0;
-
-	for (i = 1; i <= len1; i++)
-		m[i][0] = i;
-	for (j = 1; j <= len2; j++)
-		m[0][j] = j;
-
-	for (i = 1; i <= len1; i++)
-		for (j = 1; j <= len2; j++)
-			if (s1[i - 1] == s2[j - 1])
-				m[i][j] = m[i - 1][j - 1];
-			else
-				m[i][j] = min(m[i - 1][j - 1] + 1,
-						m[i - 1][j] + 1,
-						m[i][j - 1] + 1);
-	return m[len1][len2];
+	return levenshtein_distance(s1, strlen(s1), s2, strlen(s2));
 }
 
 
@@ -179,384 +206,1649 @@ free_word_list(word_list *list)
 	}
 }
 
-static void
-add_candidate_node(char *candidate, word_list **candidates, word_list **tail, float weight)
-{
-	if (*candidates == NULL) {
-		*candidates = malloc(sizeof(**candidates));
-		(*candidates)->next = NULL;
-		(*candidates)->word = candidate;
-		(*candidates)->weight = weight;
-		*tail = *candidates;
-	} else {
-		word_list *node = malloc(sizeof(*node));
-		node->word = candidate;
-		node->next = NULL;
-		node->weight = weight;
-		(*tail)->next = node;
-		*tail = node;
-	}
-}
-
 /*
- * edits1--
- *  edits1 generates all permutations of the characters of a
- *  given word at maximum edit distance of 1.
+ * Candidates of a suggestion query. They are packed back to back in pool,
+ * each NUL terminated and found through offsets, with their weights in the
+ * parallel array weights. The arrays only ever grow, so once they are big
+ * enough for the queries at hand generating candidates does not allocate.
  *
- *  All details are in the article mentioned at the top. But basically it generates 4
- *  types of possible arrangements of the chracters of a given word, stores them in an array and
- *  at the end returns that array to the caller. The 4 different arrangements
- *  are: (n = strlen(word) in the following description)
- *  1. Deletes: Delete one character at a time: n possible words
- *  2. Trasnposes: Change positions of two adjacent characters: n -1 possible words
- *  3. Replaces: Replace each character by one of the 26 alphabetes in English:
- *      26 * n possible words
- *  4. Inserts: Insert an alphabet at each of the character positions (one at a
- *      time. 26 * (n + 1) possible words.
+ * No candidate is stored twice: slots is an open addressing hash set,
+ * probed linearly, of the candidates. A slot holds one plus the index of
+ * a candidate, 0 when it is free, and at most half of them are in use.
  *
- *   This implementation is Based on the edit distance or Levenshtein distance technique.
- *   Explained by Peter Norvig in his post here: http://norvig.com/spell-correct.html
+ * Candidates which come out of a search of the dictionary, added with
+ * add_match, also keep the count found there and their distance to the
+ * misspelling in counts and distances, which have room for matchsize of
+ * them. nmatched says how many candidates were added that way.
  */
-static word_list *
-edits1(char *word, size_t distance)
+typedef struct candidate_buf {
+	char *pool;
+	size_t poollen;
+	size_t poolsize;
+	size_t *offsets;
+	float *weights;
+	size_t n;
+	size_t size;
+	uint32_t *slots;
+	size_t nslots;
+	size_t *counts;
+	size_t *distances;
+	size_t matchsize;
+	size_t nmatched;
+} candidate_buf;
+
+/*
+ * Blocks of a query arena. The data of a block starts right after its
+ * header, rounded up to ARENA_ALIGN.
+ */
+typedef struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+} arena_block;
+
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/*
+ * Per thread context of the suggestion queries: two candidate buffers
+ * for the words at distance 1 and 2, two more for the metaphone codes
+ * looked up by the phonetic fallbacks, and one per chunk of a distance 2
+ * expansion shared out to the thread pool.
+ *
+ * Every other temporary of a query, from the word_list nodes of the
+ * phonetic buckets to the arrays spell_get_corrections ranks candidates
+ * in, is carved out of the bump arena in arena and given back all at once
+ * by query_reset when the query is done. The candidate buffers are not:
+ * they grow in place and are reused as they are from one query to the
+ * next.
+ */
+typedef struct spell_query_ctx {
+	candidate_buf edits[2];
+	candidate_buf codes[2];
+	candidate_buf *chunks;
+	size_t nchunks;
+	arena_block *arena;
+} spell_query_ctx;
+
+static pthread_key_t query_key;
+static pthread_once_t query_once = PTHREAD_ONCE_INIT;
+
+static void
+free_candidates(candidate_buf *c)
 {
-	size_t i, j, len_a, len_b;
-	char alphabet;
-	size_t wordlen = strlen(word);
-	if (wordlen < 1)
-		return NULL;
-	size_t counter = 0;
-	set splits[wordlen + 1];
-	word_list *candidates = NULL;
-	word_list *tail = NULL;
-	char *word_soundex = double_metaphone(word);
-	char *candidate_soundex;
-	const char alphabets[] = "abcdefghijklmnopqrstuvwxyz- ";
-
-	/* Start by generating a split up of the characters in the word */
-	for (i = 0; i < wordlen + 1; i++) {
-		splits[i].a = (char *) malloc(i + 1);
-		splits[i].b = (char *) malloc(wordlen - i + 1);
-		memcpy(splits[i].a, word, i);
-		memcpy(splits[i].b, word + i, wordlen - i + 1);
-		splits[i].a[i] = 0;
-	}
-
-	/* Now generate all the permutations at maximum edit distance of 1.
-	 * counter keeps track of the current index position in the array
-	 * candidates where the next permutation needs to be stored. */
-	for (i = 0; i < wordlen + 1; i++) {
-		len_a = strlen(splits[i].a);
-		len_b = strlen(splits[i].b);
-		assert(len_a + len_b == wordlen);
+	free(c->pool);
+	free(c->offsets);
+	free(c->weights);
+	free(c->slots);
+	free(c->counts);
+	free(c->distances);
+}
 
-		/* Deletes */
-		if (wordlen > 1 && i < wordlen) {
-			char *candidate = malloc(wordlen);
-			memcpy(candidate, splits[i].a, len_a);
-			if (len_b - 1 > 0)
-				memcpy(candidate + len_a, splits[i].b + 1, len_b - 1);
-			candidate[wordlen - 1] = 0;
-			float weight = 1.0 / distance;
-			if (i == 0)
-				weight /= 1000;
-			weight /= 10;
-			candidate_soundex = double_metaphone(candidate);
-			if (word_soundex && candidate_soundex && strcmp(candidate_soundex, word_soundex) == 0)
-				weight *= 20;
-			free(candidate_soundex);
-			add_candidate_node(candidate, &candidates, &tail, weight);
-		}
-		/* Transposes */
-		if (i < wordlen - 1 && len_b >= 2 && splits[i].b[0] != splits[i].b[1]) {
-			char *candidate = malloc(wordlen + 1);
-			memcpy(candidate, splits[i].a, len_a);
-			candidate[len_a] = splits[i].b[1];
-			candidate[len_a + 1] = splits[i].b[0];
-			memcpy(candidate + len_a + 2, splits[i].b + 2, len_b - 2);
-			candidate[wordlen] = 0;
-			float weight = 1.0 / distance;
-			if (i == 0)
-				weight /= 1000;
-			candidate_soundex = double_metaphone(candidate);
-			if (word_soundex && candidate_soundex && strcmp(candidate_soundex, word_soundex) == 0)
-				weight *= 20;
-			free(candidate_soundex);
-			add_candidate_node(candidate, &candidates, &tail, weight);
-		}
-		/* For replaces and inserts, run a loop from 'a' to 'z' */
-		for (j = 0; j < sizeof(alphabets) - 1; j++) {
-			alphabet = alphabets[j];
-			float weight = 1.0 / distance;
-			/* Replaces */
-			if (i < wordlen && splits[i].b[0] != alphabet) {
-				char *candidate = malloc(wordlen + 1);
-				memcpy(candidate, splits[i].a, len_a);
-				candidate[len_a] = alphabet;
-				if (len_b - 1 >= 1)
-					memcpy(candidate + len_a + 1, splits[i].b + 1, len_b - 1);
-				candidate[wordlen] = 0;
-				weight = 1.0 / distance;
-				if (i == 0)
-					weight /= 1000;
-				candidate_soundex = double_metaphone(candidate);
-				if (word_soundex && candidate_soundex && strcmp(candidate_soundex, word_soundex) == 0)
-					weight *= 20;
-				weight /= 10;
-				free(candidate_soundex);
-				add_candidate_node(candidate, &candidates, &tail, weight);
-			}
-			/* Inserts */
-			char *candidate = malloc(wordlen + 2);
-			memcpy(candidate, splits[i].a, len_a);
-			candidate[len_a] = alphabet;
-			if (len_b >= 1)
-				memcpy(candidate + len_a + 1, splits[i].b, len_b);
-			candidate[wordlen + 1] = 0;
-			weight = 1.0 / distance;
-			if (i == 0)
-				weight /= 1000;
-			weight *= 10;
-			candidate_soundex = double_metaphone(candidate);
-			if (word_soundex && candidate_soundex && strcmp(candidate_soundex, word_soundex) == 0)
-				weight *= 20;
-			free(candidate_soundex);
-			add_candidate_node(candidate, &candidates, &tail, weight);
-		}
+static void
+free_arena(arena_block *block)
+{
+	arena_block *next;
+
+	for (; block != NULL; block = next) {
+		next = block->next;
+		free(block);
 	}
+}
+
+static void
+free_query_ctx(void *arg)
+{
+	spell_query_ctx *ctx = arg;
+	size_t i;
 
-	for (i = 0; i < wordlen + 1; i++) {
-		free(splits[i].a);
-		free(splits[i].b);
+	for (i = 0; i < 2; i++) {
+		free_candidates(&ctx->edits[i]);
+		free_candidates(&ctx->codes[i]);
 	}
-	free(word_soundex);
-	return candidates;
+	for (i = 0; i < ctx->nchunks; i++)
+		free_candidates(&ctx->chunks[i]);
+	free(ctx->chunks);
+	free_arena(ctx->arena);
+	free(ctx);
 }
 
-/*
- * Returns a list of words at an edit distance +1 than the words
- * in the list passed through the parameter edits1_list
- */
-static word_list *
-edits_plus_one(word_list *edits1_list)
+static void
+query_key_init(void)
 {
-	word_list *nodep = edits1_list;
-	word_list *edits2_list = NULL;
-	word_list *tail = edits1_list;
-	word_list *templist;
-	if (edits1_list == NULL)
-		return NULL;
+	if (pthread_key_create(&query_key, free_query_ctx) != 0)
+		errx(EXIT_FAILURE, "pthread_key_create failed");
+}
 
-	while (nodep->next != NULL) {
-		templist = edits1(nodep->word, 2);
-		nodep = nodep->next;
-		if (templist == NULL)
-			continue;
+static spell_query_ctx *
+get_query_ctx(void)
+{
+	spell_query_ctx *ctx;
 
-		if (edits2_list == NULL) {
-			edits2_list = templist;
-			tail = edits2_list;
-		} else
-			tail->next = templist;
-		while (tail->next != NULL)
-			tail = tail->next;
+	pthread_once(&query_once, query_key_init);
+	ctx = pthread_getspecific(query_key);
+	if (ctx == NULL) {
+		if ((ctx = calloc(1, sizeof(*ctx))) == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+		if (pthread_setspecific(query_key, ctx) != 0)
+			errx(EXIT_FAILURE, "pthread_setspecific failed");
 	}
-	return edits2_list;
+	return ctx;
 }
 
+static arena_block *
+new_arena_block(size_t size, arena_block *next)
+{
+	arena_block *block = malloc(ARENA_ROUND(sizeof(*block)) + size);
 
-static int
-max_count(const void *node1, const void *node2)
+	if (block == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	block->next = next;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+/*
+ * query_alloc--
+ *  Returns size bytes of the arena of ctx, valid until the next
+ *  query_reset. A request the current block cannot hold starts a new
+ *  one, at least twice as big.
+ */
+static void *
+query_alloc(spell_query_ctx *ctx, size_t size)
 {
-	word_list *wc1 = (word_list *) node1;
-	word_list *wc2 = (word_list *) node2;
-	if (wc1->weight == wc2->weight)
-		return 0;
+	arena_block *block = ctx->arena;
+	size_t blocksize;
+	void *p;
 
-	return wc1->weight > wc2->weight ? -1: 1;
+	size = ARENA_ROUND(size);
+	if (block == NULL || block->size - block->used < size) {
+		blocksize = block == NULL ? ARENA_BLOCK_SIZE : block->size * 2;
+		while (blocksize < size)
+			blocksize *= 2;
+		block = ctx->arena = new_arena_block(blocksize, block);
+	}
+	p = (char *) block + ARENA_ROUND(sizeof(*block)) + block->used;
+	block->used += size;
+	return p;
 }
 
-static word_list*
-spell_get_corrections(spell_t *spell, word_list *candidate_list, size_t n, char *word)
+/*
+ * query_reset--
+ *  Gives back everything allocated from the arena of ctx. If the query
+ *  needed more than one block they are replaced by a single one holding
+ *  them all, so that the next query like it never leaves its first block.
+ */
+static void
+query_reset(spell_query_ctx *ctx)
 {
-	size_t i = 0, corrections_count = 0;
-	size_t corrections_size = 16;
-	word_list *nodep = candidate_list;
-	float weight;
-	word_list *ret = NULL;
+	arena_block *block;
+	size_t size = 0;
 
-	if (candidate_list == NULL)
-		return NULL;
+	if (ctx->arena == NULL)
+		return;
+	if (ctx->arena->next != NULL) {
+		for (block = ctx->arena; block != NULL; block = block->next)
+			size += block->size;
+		free_arena(ctx->arena);
+		ctx->arena = new_arena_block(size, NULL);
+	}
+	ctx->arena->used = 0;
+}
 
-	char *metaphone_word = double_metaphone(word);
-	word_list *wl_array = malloc(corrections_size * sizeof(*wl_array));
-	while (nodep->next != NULL) {
-		char *candidate = nodep->word;
-		weight = nodep->weight;
-		nodep = nodep->next;
-		word_list listnode;
-		//char *front = look(candidate, spell->dictionary->front, spell->dictionary->back);
-		//size_t count = (size_t) (front != NULL? get_count(front, '\t'): 0);
-		size_t count = trie_get(spell->dictionary, candidate);
-		if (count == 0)
-			continue;
-		listnode.weight = count * weight;
-		listnode.word = (candidate);
-		size_t distance = edit_distance(candidate, word);
-		if (distance > 6)
-			continue;
-		char *metaphone_candidate = double_metaphone(candidate);
-		size_t meta_distance = edit_distance(metaphone_candidate, metaphone_word);
-		free(metaphone_candidate);
+static void
+clear_candidates(candidate_buf *c)
+{
+	if (c->n > 0)
+		memset(c->slots, 0, c->nslots * sizeof(*c->slots));
+	c->n = 0;
+	c->nmatched = 0;
+	c->poollen = 0;
+}
+
+static char *
+candidate_word(const candidate_buf *c, size_t i)
+{
+	return c->pool + c->offsets[i];
+}
 
-		listnode.weight /= (pow(10,distance)) ;
-		listnode.weight /= (pow(10, meta_distance));
-		wl_array[corrections_count++] = listnode;
+static uint32_t *
+probe_candidate(uint32_t *slots, size_t nslots, const candidate_buf *c,
+    const char *s, size_t len)
+{
+	size_t i = fnv1a_hash(FNV1A_BASIS, s, len) & (nslots - 1);
+	const char *t;
 
-		if (corrections_count == corrections_size - 1) {
-			corrections_size *= 2;
-			wl_array = realloc(wl_array, corrections_size * sizeof(*wl_array));
-		}
+	while (slots[i] != 0) {
+		t = candidate_word(c, slots[i] - 1);
+		if (strncmp(t, s, len) == 0 && t[len] == 0)
+			break;
+		i = (i + 1) & (nslots - 1);
 	}
-	free(metaphone_word);
+	return &slots[i];
+}
 
-	if (corrections_count == 0) {
-		free(wl_array);
-		return NULL;
-	}
+/*
+ * Returns the slot of the len characters long string s in the hash set of
+ * c: the one of the candidate equal to s if there is one, else the free
+ * slot commit_candidate is to fill with it. There is always room for one
+ * more candidate.
+ */
+static uint32_t *
+find_candidate(candidate_buf *c, const char *s, size_t len)
+{
+	uint32_t *slots;
+	size_t nslots, i;
+	const char *t;
 
-	size_t arraysize = n < corrections_count? n: corrections_count;
-//	char **corrections = malloc((arraysize + 1) * sizeof(*corrections));
-//	corrections[arraysize] = NULL;
-	qsort(wl_array, corrections_count, sizeof(*wl_array), max_count);
-/*(	for (i = 0; i < arraysize; i++) {
-		if (wl_array[i].word) {
-			corrections[i] =  strdup(wl_array[i].word);
-			//printf("%s %f\n", wl_array[i].word, wl_array[i].weight);
+	if (2 * (c->n + 1) > c->nslots) {
+		nslots = c->nslots ? c->nslots * 2 : 1024;
+		if ((slots = calloc(nslots, sizeof(*slots))) == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+		for (i = 0; i < c->n; i++) {
+			t = candidate_word(c, i);
+			*probe_candidate(slots, nslots, c, t, strlen(t)) = i + 1;
 		}
+		free(c->slots);
+		c->slots = slots;
+		c->nslots = nslots;
 	}
-	free(wl_array);
-	return corrections;*/
-	word_list *node;
-	word_list *prevnode = NULL;
-	for (i = 0; i < arraysize ; i++)  {
-		node = malloc(sizeof(*node));
-		node->word = strdup(wl_array[i].word);
-		node->next = NULL;
-		if (prevnode != NULL)
-			prevnode->next = node;
+	return probe_candidate(c->slots, c->nslots, c, s, len);
+}
+
+/*
+ * Returns the place at the end of the pool where a candidate of len
+ * characters is to be written before calling commit_candidate.
+ */
+static char *
+reserve_candidate(candidate_buf *c, size_t len)
+{
+	size_t size;
 
-		if (ret == NULL)
-			ret = node;
-		prevnode = node;
+	if (c->poollen + len + 1 > c->poolsize) {
+		size = c->poolsize ? c->poolsize * 2 : 4096;
+		while (size < c->poollen + len + 1)
+			size *= 2;
+		if ((c->pool = realloc(c->pool, size)) == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+		c->poolsize = size;
 	}
-	free(wl_array);
-	return ret;
+	return c->pool + c->poollen;
 }
 
-void
-free_list(char **list)
+static void
+commit_candidate(candidate_buf *c, uint32_t *slot, size_t len, float weight)
 {
-	size_t i = 0;
-	if (list == NULL)
+	if (c->n == c->size) {
+		c->size = c->size ? c->size * 2 : 256;
+		c->offsets = realloc(c->offsets, c->size * sizeof(*c->offsets));
+		c->weights = realloc(c->weights, c->size * sizeof(*c->weights));
+		if (c->offsets == NULL || c->weights == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+	}
+	c->pool[c->poollen + len] = 0;
+	c->offsets[c->n] = c->poollen;
+	c->weights[c->n++] = weight;
+	c->poollen += len + 1;
+	*slot = c->n;
+}
+
+/*
+ * Adds word to c, unless it is already there, in which case it keeps the
+ * larger of the two weights.
+ */
+static void
+add_candidate(candidate_buf *c, const char *word, float weight)
+{
+	size_t len = strlen(word);
+	uint32_t *slot = find_candidate(c, word, len);
+
+	if (*slot != 0) {
+		if (weight > c->weights[*slot - 1])
+			c->weights[*slot - 1] = weight;
 		return;
+	}
+	memcpy(reserve_candidate(c, len), word, len);
+	commit_candidate(c, slot, len, weight);
+}
 
-	while (list[i] != NULL)
-		free(list[i++]);
-	free(list);
+/*
+ * Same as add_candidate, for a dictionary word found with count
+ * occurrences at the given distance from the misspelling, so that ranking it
+ * needs neither to be computed again.
+ */
+static void
+add_match(candidate_buf *c, const char *word, size_t count, size_t distance,
+    float weight)
+{
+	size_t len = strlen(word);
+	uint32_t *slot = find_candidate(c, word, len);
+
+	if (*slot != 0) {
+		if (weight > c->weights[*slot - 1])
+			c->weights[*slot - 1] = weight;
+		return;
+	}
+	memcpy(reserve_candidate(c, len), word, len);
+	commit_candidate(c, slot, len, weight);
+	if (c->matchsize < c->size) {
+		c->counts = realloc(c->counts, c->size * sizeof(*c->counts));
+		c->distances = realloc(c->distances,
+		    c->size * sizeof(*c->distances));
+		if (c->counts == NULL || c->distances == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+		c->matchsize = c->size;
+	}
+	c->counts[c->n - 1] = count;
+	c->distances[c->n - 1] = distance;
+	c->nmatched++;
 }
 
+/*
+ * Tells whether the metaphone code of the len characters long candidate
+ * is code. The candidate must already be NUL terminated.
+ */
 static int
-compare_listnodes(void *context, const void *node1, const void *node2)
+same_metaphone(const char *candidate, size_t len, const char *code)
 {
-	const word_list *wl1 = (const word_list *) node1;
-	const word_list *wl2 = (const word_list *) node2;
+	char candidate_code[METAPHONE_CODE_MAX];
 
-	return strcmp(wl1->word, wl2->word);
+	return strcmp(metaphone_code(candidate, candidate_code), code) == 0;
 }
 
-static int
-parse_file_and_generate_trie(FILE * f, trie_t * tree, char field_separator)
+/* Number of 64 bit words in a set of bytes */
+#define CHARSET_WORDS 4
+
+/*
+ * The characters used by a set of strings and which of them follow each
+ * other. follows[a] has bit b set when some string has b right after a,
+ * and precedes[b] then has bit a set. A 0 stands for the start of a
+ * string in follows and for its end in precedes, so follows[0] holds the
+ * first characters of the strings and precedes[0] the last ones.
+ *
+ * The sets only ever gain bits, set atomically, so strings can be added
+ * while edits1 reads them on other threads.
+ */
+struct spell_alphabet {
+	uint64_t chars[CHARSET_WORDS];
+	uint64_t follows[UCHAR_MAX + 1][CHARSET_WORDS];
+	uint64_t precedes[UCHAR_MAX + 1][CHARSET_WORDS];
+};
+
+static void
+charset_add(uint64_t *set, unsigned char c)
 {
-	if (f == NULL)
-		return -1;
+	__atomic_fetch_or(&set[c / 64], (uint64_t) 1 << (c % 64), __ATOMIC_RELAXED);
+}
 
-	char *line = NULL;
-	size_t count;
-	size_t linesize = 0;
-	size_t wordsize = 0;
-	ssize_t bytes_read;
-	word_count *wcnode;
-	word_count wc;
-	wc.count = 0;
-	while ((bytes_read = getline(&line, &linesize, f)) != -1) {
-		line[bytes_read - 1] = 0;
-		char *templine = line;
-		if (field_separator) {
-			char *sepindex = strchr(templine, field_separator);
-			if (sepindex == NULL) {
-				free(line);
-				return -1;
-			}
-			sepindex[0] = 0;
-			count = strtol(sepindex + 1, NULL, 10);
-		} else
-			/* Since our trie expects to store a count of the
-			 * frequency of the word and for some cases (such as
-			 * the whitelist word file) we don't have those
-			 * counts, set the default count as 1
-			 */
-			count = 1;
+static void
+alphabet_add(struct spell_alphabet *alphabet, const char *s)
+{
+	const unsigned char *p = (const unsigned char *) s;
+	unsigned char prev = 0;
 
-		lower(templine);
-		trie_insert(&tree, templine, count);
-		free(line);
-		line = NULL;
+	for (; *p != 0; prev = *p++) {
+		charset_add(alphabet->chars, *p);
+		charset_add(alphabet->follows[prev], *p);
+		charset_add(alphabet->precedes[*p], prev);
+	}
+	if (prev != 0) {
+		charset_add(alphabet->follows[prev], 0);
+		charset_add(alphabet->precedes[0], prev);
 	}
-	free(line);
-	return 0;
 }
 
-static int
-parse_file_and_generate_tree(FILE *f, rb_tree_t *tree, char field_separator)
+/*
+ * Adds the words of t straight from its nodes, without spelling them out:
+ * a node follows the character of the node whose middle subtree holds
+ * it, and ends a word when it has a value.
+ */
+static void
+alphabet_add_trie(struct spell_alphabet *alphabet, const trie_t *t)
 {
-	if (f == NULL)
-		return -1;
+	const trie_node_t *n;
+	struct {
+		uint32_t node;
+		unsigned char prev;
+	} *stack;
+	size_t depth = 0;
+	unsigned char c, prev;
 
-	char *word = NULL;
-	char *line = NULL;
-	long count;
-	size_t linesize = 0;
-	size_t wordsize = 0;
-	ssize_t bytes_read;
-	word_count *wcnode;
-	word_count wc;
-	wc.count = 0;
-	while ((bytes_read = getline(&line, &linesize, f)) != -1) {
-		line[bytes_read - 1] = 0;
-		char *templine = line;
-		if (field_separator) {
-			char *sepindex = strchr(templine, field_separator);
-			if (sepindex == NULL) {
-				free(line);
-				return -1;
-			}
-			sepindex[0] = 0;
-			count = strtol(sepindex + 1, NULL, 10);
-		} else
-			count = 1;
+	if (t == NULL || t->nodes[0].character == 0)
+		return;
+	/* Each node is pushed once, from the node linking to it */
+	if ((stack = malloc(t->nnodes * sizeof(*stack))) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	stack[depth].node = 0;
+	stack[depth++].prev = 0;
+	while (depth > 0) {
+		depth--;
+		n = &t->nodes[stack[depth].node];
+		prev = stack[depth].prev;
+		c = n->character;
+		charset_add(alphabet->chars, c);
+		charset_add(alphabet->follows[prev], c);
+		charset_add(alphabet->precedes[c], prev);
+		if (n->value != 0) {
+			charset_add(alphabet->follows[c], 0);
+			charset_add(alphabet->precedes[0], c);
+		}
+		if (n->left != TRIE_NIL) {
+			stack[depth].node = n->left;
+			stack[depth++].prev = prev;
+		}
+		if (n->right != TRIE_NIL) {
+			stack[depth].node = n->right;
+			stack[depth++].prev = prev;
+		}
+		if (n->middle != TRIE_NIL) {
+			stack[depth].node = n->middle;
+			stack[depth++].prev = c;
+		}
+	}
+	free(stack);
+}
+
+static struct spell_alphabet *
+alphabet_init(void)
+{
+	struct spell_alphabet *alphabet;
+
+	if ((alphabet = calloc(1, sizeof(*alphabet))) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	return alphabet;
+}
+
+/*
+ * Fills set with the characters that can go between prev and next in a
+ * string of the alphabet, 0 standing for either end of the string.
+ */
+static void
+alphabet_between(const struct spell_alphabet *alphabet, unsigned char prev,
+    unsigned char next, uint64_t *set)
+{
+	size_t i;
+
+	for (i = 0; i < CHARSET_WORDS; i++)
+		set[i] = __atomic_load_n(&alphabet->follows[prev][i], __ATOMIC_RELAXED) &
+		    __atomic_load_n(&alphabet->precedes[next][i], __ATOMIC_RELAXED);
+	/* Bit 0 marks the ends of the strings, it is no character */
+	set[0] &= ~(uint64_t) 1;
+}
+
+static void
+alphabet_all(const struct spell_alphabet *alphabet, uint64_t *set)
+{
+	size_t i;
+
+	for (i = 0; i < CHARSET_WORDS; i++)
+		set[i] = __atomic_load_n(&alphabet->chars[i], __ATOMIC_RELAXED);
+}
+
+/*
+ * Describes a set of strings edits1 generates candidates for. alphabet
+ * returns the characters the set is made of. keep tells whether a string
+ * is one of the set, and prefix returns the length of the longest prefix
+ * of a string that some string of the set starts with. A filter without
+ * keep keeps every string: such strings are only stepping stones towards
+ * the set.
+ */
+typedef struct candidate_filter {
+	int (*keep)(spell_t *, const char *);
+	size_t (*prefix)(spell_t *, const char *);
+	const struct spell_alphabet *(*alphabet)(spell_t *);
+} candidate_filter;
+
+/*
+ * Finishes the len characters long string edits1 wrote at the end of out.
+ * It is dropped unless it passes keep, and only then is its weight raised
+ * when it sounds like the original word, whose metaphone code is code.
+ * Without keep every string is kept as is: such strings are only
+ * stepping stones or phonetic codes, whose weights do not matter.
+ *
+ * A string already in out is not added again, it only keeps the larger
+ * of its weights. The strings are checked against keep before that:
+ * looking up a non-word in the dictionary is cheaper than hashing it.
+ */
+static void
+finish_candidate(spell_t *spell, const candidate_filter *keep, candidate_buf *out,
+    size_t len, float weight, const char *code)
+{
+	char *candidate = out->pool + out->poollen;
+	uint32_t *slot;
+
+	candidate[len] = 0;
+	if (keep->keep != NULL) {
+		if (!keep->keep(spell, candidate))
+			return;
+		if (same_metaphone(candidate, len, code))
+			weight *= 20;
+	}
+	slot = find_candidate(out, candidate, len);
+	if (*slot != 0) {
+		if (weight > out->weights[*slot - 1])
+			out->weights[*slot - 1] = weight;
+		return;
+	}
+	commit_candidate(out, slot, len, weight);
+}
+
+/*
+ * edits1--
+ *  edits1 generates all permutations of the characters of a
+ *  given word at maximum edit distance of 1 and appends those passing
+ *  keep to out.
+ *
+ *  All details are in the article mentioned at the top. But basically it generates 4
+ *  types of possible arrangements of the chracters of a given word. The 4 different arrangements
+ *  are: (n = strlen(word) in the following description)
+ *  1. Deletes: Delete one character at a time: n possible words
+ *  2. Trasnposes: Change positions of two adjacent characters: n -1 possible words
+ *  3. Replaces: Replace each character by one of the characters of the
+ *      alphabet of the set: a * n possible words
+ *  4. Inserts: Insert a character of the alphabet at each of the character
+ *      positions (one at a time): a * (n + 1) possible words.
+ *
+ *  Most of these are not words, so each one is checked against keep as
+ *  soon as it is generated and the phonetic weighting is left to the few
+ *  that survive. With keep, a character is only put where the strings of
+ *  the set have it after the character before and before the one after.
+ *
+ *   This implementation is Based on the edit distance or Levenshtein distance technique.
+ *   Explained by Peter Norvig in his post here: http://norvig.com/spell-correct.html
+ */
+static void
+edits1(spell_t *spell, const char *word, size_t distance,
+    const candidate_filter *keep, candidate_buf *out)
+{
+	size_t i, j, last;
+	unsigned char alphabet, prev, next;
+	size_t wordlen = strlen(word);
+	if (wordlen < 1)
+		return;
+	char word_soundex[METAPHONE_CODE_MAX];
+	char *candidate;
+	float weight;
+	const struct spell_alphabet *alphabets = keep->alphabet(spell);
+	uint64_t replaces[CHARSET_WORDS], inserts[CHARSET_WORDS], replace, chars;
+
+	/*
+	 * Every edit at split i keeps word[0..i) as it is, so once that is not
+	 * the start of any string of the set none of the later splits can
+	 * yield one either.
+	 */
+	last = wordlen;
+	if (keep->keep != NULL) {
+		last = keep->prefix(spell, word);
+		metaphone_code(word, word_soundex);
+	} else {
+		alphabet_all(alphabets, inserts);
+		memcpy(replaces, inserts, sizeof(replaces));
+	}
+
+	/* Every split of the word into word[0..i) and word[i..wordlen) */
+	for (i = 0; i <= last; i++) {
+		/* Deletes */
+		if (wordlen > 1 && i < wordlen) {
+			candidate = reserve_candidate(out, wordlen - 1);
+			memcpy(candidate, word, i);
+			memcpy(candidate + i, word + i + 1, wordlen - i - 1);
+			weight = 1.0 / distance;
+			if (i == 0)
+				weight /= 1000;
+			weight /= 10;
+			finish_candidate(spell, keep, out, wordlen - 1, weight, word_soundex);
+		}
+		/* Transposes */
+		if (i < wordlen - 1 && word[i] != word[i + 1]) {
+			candidate = reserve_candidate(out, wordlen);
+			memcpy(candidate, word, i);
+			candidate[i] = word[i + 1];
+			candidate[i + 1] = word[i];
+			memcpy(candidate + i + 2, word + i + 2, wordlen - i - 2);
+			weight = 1.0 / distance;
+			if (i == 0)
+				weight /= 1000;
+			finish_candidate(spell, keep, out, wordlen, weight, word_soundex);
+		}
+		/* Replaces and inserts, with the characters that fit in there */
+		if (keep->keep != NULL) {
+			prev = i > 0 ? word[i - 1] : 0;
+			next = i < wordlen ? word[i + 1] : 0;
+			alphabet_between(alphabets, prev, next, replaces);
+			alphabet_between(alphabets, prev, word[i], inserts);
+		}
+		for (j = 0; j < CHARSET_WORDS; j++) {
+			replace = i < wordlen ? replaces[j] : 0;
+			for (chars = replace | inserts[j]; chars != 0; chars &= chars - 1) {
+				alphabet = j * 64 + __builtin_ctzll(chars);
+				/* Replaces */
+				if ((replace >> (alphabet % 64) & 1) &&
+				    (unsigned char) word[i] != alphabet) {
+					candidate = reserve_candidate(out, wordlen);
+					memcpy(candidate, word, wordlen);
+					candidate[i] = alphabet;
+					weight = 1.0 / distance;
+					if (i == 0)
+						weight /= 1000;
+					weight /= 10;
+					finish_candidate(spell, keep, out, wordlen, weight, word_soundex);
+				}
+				/* Inserts */
+				if ((inserts[j] >> (alphabet % 64) & 1) == 0)
+					continue;
+				candidate = reserve_candidate(out, wordlen + 1);
+				memcpy(candidate, word, i);
+				candidate[i] = alphabet;
+				memcpy(candidate + i + 1, word + i, wordlen - i);
+				weight = 1.0 / distance;
+				if (i == 0)
+					weight /= 1000;
+				weight *= 10;
+				finish_candidate(spell, keep, out, wordlen + 1, weight, word_soundex);
+			}
+		}
+	}
+}
+
+/* Chunks of a distance 2 expansion per thread of the pool */
+#define CHUNKS_PER_THREAD 4
+
+/*
+ * A distance 2 expansion shared out to the thread pool. The strings of in
+ * are cut into nchunks chunks of consecutive strings, each expanded into
+ * its own buffer whichever thread runs it.
+ */
+typedef struct expansion {
+	spell_t *spell;
+	const candidate_buf *in;
+	const candidate_filter *keep;
+	candidate_buf *chunks;
+	size_t nchunks;
+} expansion;
+
+static void
+expand_chunk(void *arg, size_t chunk)
+{
+	expansion *e = arg;
+	size_t i = e->in->n * chunk / e->nchunks;
+	size_t end = e->in->n * (chunk + 1) / e->nchunks;
+
+	clear_candidates(&e->chunks[chunk]);
+	for (; i < end; i++)
+		edits1(e->spell, candidate_word(e->in, i), 2, e->keep, &e->chunks[chunk]);
+}
+
+/*
+ * Appends to out the strings passing keep at an edit distance +1 than
+ * the strings in in.
+ *
+ * With a thread pool the strings of in are expanded in chunks by all of
+ * its threads. The chunks are then merged in order, which leaves out
+ * exactly as a single thread would have: every string where it first
+ * shows up, with the largest of its weights.
+ */
+static void
+edits_plus_one(spell_t *spell, const candidate_buf *in,
+    const candidate_filter *keep, candidate_buf *out)
+{
+	spell_query_ctx *ctx;
+	expansion e;
+	size_t i, j, nchunks;
+
+	if (spell->pool != NULL) {
+		nchunks = workpool_size(spell->pool) * CHUNKS_PER_THREAD;
+		if (in->n >= nchunks) {
+			ctx = get_query_ctx();
+			if (ctx->nchunks < nchunks) {
+				ctx->chunks = realloc(ctx->chunks,
+				    nchunks * sizeof(*ctx->chunks));
+				if (ctx->chunks == NULL)
+					err(EXIT_FAILURE, "malloc failed");
+				memset(ctx->chunks + ctx->nchunks, 0,
+				    (nchunks - ctx->nchunks) * sizeof(*ctx->chunks));
+				ctx->nchunks = nchunks;
+			}
+			e.spell = spell;
+			e.in = in;
+			e.keep = keep;
+			e.chunks = ctx->chunks;
+			e.nchunks = nchunks;
+			if (workpool_run(spell->pool, nchunks, expand_chunk, &e) == 0) {
+				for (i = 0; i < nchunks; i++)
+					for (j = 0; j < e.chunks[i].n; j++)
+						add_candidate(out, candidate_word(&e.chunks[i], j),
+						    e.chunks[i].weights[j]);
+				return;
+			}
+		}
+	}
+
+	for (i = 0; i < in->n; i++)
+		edits1(spell, candidate_word(in, i), 2, keep, out);
+}
+
+/*
+ * Updates of the dictionary are published RCU style: a writer copies the
+ * trie, changes the copy and swaps it in with one atomic store, and the
+ * old copy is freed once no reader can still be looking at it. Readers
+ * never block. Each one registers in the counter of the current epoch
+ * parity for the duration of a query. The writer flips the epoch twice,
+ * each time waiting for the counter of the previous parity to drain.
+ * That covers readers which picked up the parity just before a flip.
+ */
+struct spell_rcu {
+	pthread_mutex_t writer;
+	unsigned int epoch;
+	unsigned long readers[2];
+};
+
+static struct spell_rcu *
+spell_rcu_init(void)
+{
+	struct spell_rcu *rcu = calloc(1, sizeof(*rcu));
+
+	if (rcu == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	pthread_mutex_init(&rcu->writer, NULL);
+	return rcu;
+}
+
+/*
+ * Starts a read-side section and fills view with the current version of
+ * the dictionary, which stays valid until spell_read_unlock. Queries run
+ * against the view so that they see one version from start to end.
+ *
+ * The dictionary and the hot set change under the readers, so they are
+ * only read with atomic loads, never as part of a struct copy. The hot
+ * set is loaded first: spell_add_words publishes it after the trie, so a
+ * new hot set always comes with the new trie. An old hot set may still
+ * come with a new trie, which is harmless since words are only ever
+ * added: every hot word is in every later trie.
+ */
+static unsigned int
+spell_read_lock(spell_t *spell, spell_t *view)
+{
+	struct spell_rcu *rcu = spell->rcu;
+	unsigned int idx;
+
+	idx = __atomic_load_n(&rcu->epoch, __ATOMIC_SEQ_CST) & 1;
+	__atomic_fetch_add(&rcu->readers[idx], 1, __ATOMIC_SEQ_CST);
+	view->hot = __atomic_load_n(&spell->hot, __ATOMIC_SEQ_CST);
+	view->dictionary = __atomic_load_n(&spell->dictionary, __ATOMIC_SEQ_CST);
+	view->backend = spell->backend;
+	view->dawg = spell->dawg;
+	view->art = spell->art;
+	view->louds = spell->louds;
+	view->symspell = spell->symspell;
+	view->pool = spell->pool;
+	view->cache = spell->cache;
+	view->filter = spell->filter;
+	view->alphabet = spell->alphabet;
+	view->code_alphabet = spell->code_alphabet;
+	view->ngrams_tree = spell->ngrams_tree;
+	view->soundex_tree = spell->soundex_tree;
+	view->image = spell->image;
+	view->rcu = spell->rcu;
+	return idx;
+}
+
+static void
+spell_read_unlock(spell_t *spell, unsigned int idx)
+{
+	__atomic_fetch_sub(&spell->rcu->readers[idx], 1, __ATOMIC_SEQ_CST);
+}
+
+/* Waits until every reader which may hold the previous version is done */
+static void
+spell_synchronize(struct spell_rcu *rcu)
+{
+	unsigned int epoch;
+	int flip;
+
+	for (flip = 0; flip < 2; flip++) {
+		epoch = __atomic_fetch_add(&rcu->epoch, 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&rcu->readers[epoch & 1], __ATOMIC_SEQ_CST) != 0)
+			sched_yield();
+	}
+}
+
+/* Number of most frequent words kept in the exact hot set */
+#define HOT_WORDS 2048
+
+/* Seeds telling unigrams and bigrams apart in the known word filter */
+#define UNIGRAM_SEED 0x756e6967
+#define BIGRAM_SEED 0x62696772
+
+/*
+ * The most frequent words of the dictionary, in an open addressing hash
+ * table small enough to stay in cache, probed linearly. A slot holds the
+ * third filter hash of a word and one plus its offset in words, 0 when
+ * the slot is free.
+ */
+typedef struct hot_slot {
+	uint32_t hash;
+	uint32_t word;
+} hot_slot;
+
+struct spell_hot {
+	hot_slot *slots;
+	size_t nslots;
+	char *words;
+};
+
+static int
+hot_find(const struct spell_hot *hot, const char *word, const uint32_t hashes[3])
+{
+	size_t mask = hot->nslots - 1;
+	size_t i;
+
+	for (i = hashes[2] & mask; hot->slots[i].word != 0; i = (i + 1) & mask)
+		if (hot->slots[i].hash == hashes[2] &&
+		    strcmp(hot->words + hot->slots[i].word - 1, word) == 0)
+			return 1;
+	return 0;
+}
+
+static void
+free_hot(struct spell_hot *hot)
+{
+	if (hot == NULL)
+		return;
+	free(hot->slots);
+	free(hot->words);
+	free(hot);
+}
+
+/*
+ * spell_add_words--
+ *  Adds n words to the unigram dictionary, or sets their counts if they
+ *  are already there, while queries keep running on other threads. The
+ *  queries already in flight finish on the version they started with.
+ *  Concurrent calls are serialized. Batch the words where possible: each
+ *  call copies the whole trie. Only the trie backend can be updated.
+ */
+int
+spell_add_words(spell_t *spell, char **words, const size_t *counts, size_t n)
+{
+	trie_t *old, *new;
+	struct spell_hot *oldhot, *newhot = NULL;
+	char **lowered;
+	size_t i;
+	uint32_t hashes[3];
+
+	if (spell->backend != SPELL_BACKEND_TRIE || spell->dictionary == NULL) {
+		warnx("Only the trie dictionary can be updated");
+		return -1;
+	}
+
+	if ((lowered = malloc(n * sizeof(*lowered))) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	pthread_mutex_lock(&spell->rcu->writer);
+	old = spell->dictionary;
+	oldhot = spell->hot;
+	if ((new = trie_clone(old)) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	for (i = 0; i < n; i++) {
+		if ((lowered[i] = strdup(words[i])) == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+		trie_insert(&new, lower(lowered[i]), counts[i]);
+		/*
+		 * Readers of the new trie must find its words in the alphabet
+		 * and the filter.
+		 */
+		alphabet_add(spell->alphabet, lowered[i]);
+		if (spell->filter != NULL) {
+			bloom_hash(lowered[i], strlen(lowered[i]), UNIGRAM_SEED, hashes);
+			bloom_add(spell->filter, hashes);
+		}
+	}
+	/* The trie goes first, see spell_read_lock */
+	__atomic_store_n(&spell->dictionary, new, __ATOMIC_SEQ_CST);
+	if (oldhot != NULL) {
+		newhot = update_hot(oldhot, new, lowered, n);
+		__atomic_store_n(&spell->hot, newhot, __ATOMIC_SEQ_CST);
+	}
+	spell_synchronize(spell->rcu);
+	/*
+	 * Readers only fill the cache inside their read side critical
+	 * section, so none of them can put back a stale entry after this.
+	 */
+	cache_clear(spell->cache);
+	pthread_mutex_unlock(&spell->rcu->writer);
+
+	trie_destroy(old);
+	if (newhot != NULL)
+		free_hot(oldhot);
+	for (i = 0; i < n; i++)
+		free(lowered[i]);
+	free(lowered);
+	return 0;
+}
+
+/*
+ * Returns the frequency of word in the unigram dictionary, looking it up
+ * in whichever data structure the dictionary was loaded into.
+ */
+static size_t
+dictionary_get(spell_t *spell, const char *word)
+{
+	switch (spell->backend) {
+	case SPELL_BACKEND_DAWG:
+		return dawg_get(spell->dawg, word);
+	case SPELL_BACKEND_ART:
+		return art_get(spell->art, word);
+	case SPELL_BACKEND_LOUDS:
+		return louds_get(spell->louds, word);
+	default:
+		return trie_get(spell->dictionary, word);
+	}
+}
+
+static int
+is_dictionary_word(spell_t *spell, const char *word)
+{
+	return dictionary_get(spell, word) != 0;
+}
+
+static size_t
+dictionary_prefix_len(spell_t *spell, const char *word)
+{
+	switch (spell->backend) {
+	case SPELL_BACKEND_DAWG:
+		return dawg_prefix_len(spell->dawg, word);
+	case SPELL_BACKEND_ART:
+		return art_prefix_len(spell->art, word);
+	case SPELL_BACKEND_LOUDS:
+		return louds_prefix_len(spell->louds, word);
+	default:
+		return trie_prefix_len(spell->dictionary, word);
+	}
+}
+
+static const struct spell_alphabet *
+dictionary_alphabet(spell_t *spell)
+{
+	return spell->alphabet;
+}
+
+static const candidate_filter dictionary_words = {
+	is_dictionary_word, dictionary_prefix_len, dictionary_alphabet
+};
+
+static const candidate_filter dictionary_steps = {
+	NULL, NULL, dictionary_alphabet
+};
+
+/*
+ * Looks up a batch of words at once, which lets the trie overlap the
+ * memory accesses of the individual lookups.
+ */
+static void
+dictionary_get_batch(spell_t *spell, char **words, size_t n, size_t *counts)
+{
+	size_t i;
+
+	switch (spell->backend) {
+	case SPELL_BACKEND_TRIE:
+		trie_get_batch(spell->dictionary, words, n, counts);
+		break;
+	default:
+		for (i = 0; i < n; i++)
+			counts[i] = dictionary_get(spell, words[i]);
+		break;
+	}
+}
+
+/* Candidates further than this from the misspelling are never suggested */
+#define MAX_CORRECTION_DISTANCE 6
+
+/*
+ * A suggestion kept by rank_candidates. index, the position of the
+ * candidate, breaks ties between equal weights in favour of the earlier
+ * candidate.
+ */
+typedef struct ranked_word {
+	float weight;
+	size_t index;
+	char *word;
+} ranked_word;
+
+static int
+ranks_below(const ranked_word *r1, const ranked_word *r2)
+{
+	if (r1->weight != r2->weight)
+		return r1->weight < r2->weight;
+	return r1->index > r2->index;
+}
+
+/*
+ * Restores the heap property of the nheap entries of heap, the weakest
+ * one at the top, after the top one was replaced.
+ */
+static void
+sift_down(ranked_word *heap, size_t nheap)
+{
+	ranked_word top = heap[0];
+	size_t i = 0, child;
+
+	while ((child = 2 * i + 1) < nheap) {
+		if (child + 1 < nheap && ranks_below(&heap[child + 1], &heap[child]))
+			child++;
+		if (!ranks_below(&heap[child], &top))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = top;
+}
+
+static void
+sift_up(ranked_word *heap, size_t i)
+{
+	ranked_word last = heap[i];
+	size_t parent;
+
+	while (i > 0 && ranks_below(&last, &heap[parent = (i - 1) / 2])) {
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = last;
+}
+
+/*
+ * Ranks the ncandidates candidates in keys, weighted by weights, and
+ * returns the n best ones found in the dictionary. The distances of the
+ * dictionary words to word are computed as one batch, and the n best are
+ * kept in a heap as they are scored. The list and its words belong to
+ * ctx: they are only valid until the query is reset.
+ *
+ * When the candidates come out of a search of the dictionary, their
+ * counts and their distances to word are already known: they are passed
+ * in known_counts and known_distances and neither is computed again.
+ * Both are NULL otherwise.
+ */
+static word_list *
+rank_candidates(spell_t *spell, spell_query_ctx *ctx, char **keys,
+    const float *weights, const size_t *known_counts,
+    const size_t *known_distances, size_t ncandidates, size_t n,
+    const char *word)
+{
+	size_t i, nfound = 0, nheap = 0;
+	size_t *looked_up, *found, *distances;
+	const size_t *counts;
+	char **found_keys;
+	ranked_word *heap, ranked;
+	word_list *nodes;
+	word_list *ret = NULL;
+	char metaphone_word[METAPHONE_CODE_MAX];
+
+	if (ncandidates == 0 || n == 0)
+		return NULL;
+
+	if (known_counts == NULL) {
+		looked_up = query_alloc(ctx, ncandidates * sizeof(*looked_up));
+		dictionary_get_batch(spell, keys, ncandidates, looked_up);
+		counts = looked_up;
+	} else
+		counts = known_counts;
+	found = query_alloc(ctx, ncandidates * sizeof(*found));
+	found_keys = query_alloc(ctx, ncandidates * sizeof(*found_keys));
+	for (i = 0; i < ncandidates; i++) {
+		if (counts[i] == 0)
+			continue;
+		found[nfound] = i;
+		found_keys[nfound++] = keys[i];
+	}
+	if (nfound == 0)
+		return NULL;
+
+	distances = query_alloc(ctx, nfound * sizeof(*distances));
+	if (known_distances == NULL)
+		levenshtein_distance_batch(word, strlen(word), found_keys, nfound,
+		    MAX_CORRECTION_DISTANCE, distances);
+	else
+		for (i = 0; i < nfound; i++)
+			distances[i] = known_distances[found[i]];
+	if (n > nfound)
+		n = nfound;
+	heap = query_alloc(ctx, n * sizeof(*heap));
+	metaphone_code(word, metaphone_word);
+	for (i = 0; i < nfound; i++) {
+		char *candidate = found_keys[i];
+		size_t distance = distances[i];
+		if (distance > MAX_CORRECTION_DISTANCE)
+			continue;
+		ranked.weight = counts[found[i]] * weights[found[i]];
+		ranked.index = i;
+		ranked.word = candidate;
+		char metaphone_candidate[METAPHONE_CODE_MAX];
+		metaphone_code(candidate, metaphone_candidate);
+		size_t meta_distance = edit_distance(metaphone_candidate, metaphone_word);
+
+		ranked.weight /= (pow(10,distance)) ;
+		ranked.weight /= (pow(10, meta_distance));
+		if (nheap < n) {
+			heap[nheap] = ranked;
+			sift_up(heap, nheap++);
+		} else if (ranks_below(&heap[0], &ranked)) {
+			heap[0] = ranked;
+			sift_down(heap, nheap);
+		}
+	}
+
+	if (nheap == 0)
+		return NULL;
+
+	/* Popping the weakest first builds the list from its tail */
+	nodes = query_alloc(ctx, nheap * sizeof(*nodes));
+	while (nheap > 0) {
+		nodes[nheap - 1].word = heap[0].word;
+		nodes[nheap - 1].weight = heap[0].weight;
+		nodes[nheap - 1].next = ret;
+		ret = &nodes[nheap - 1];
+		heap[0] = heap[--nheap];
+		sift_down(heap, nheap);
+	}
+	return ret;
+}
+
+static word_list*
+spell_get_corrections(spell_t *spell, word_list *candidate_list, size_t n, char *word)
+{
+	spell_query_ctx *ctx = get_query_ctx();
+	word_list *nodep;
+	size_t ncandidates = 0;
+	char **keys;
+	float *weights;
+
+	for (nodep = candidate_list; nodep != NULL; nodep = nodep->next)
+		ncandidates++;
+	keys = query_alloc(ctx, ncandidates * sizeof(*keys));
+	weights = query_alloc(ctx, ncandidates * sizeof(*weights));
+	ncandidates = 0;
+	for (nodep = candidate_list; nodep != NULL; nodep = nodep->next) {
+		keys[ncandidates] = nodep->word;
+		weights[ncandidates++] = nodep->weight;
+	}
+	return rank_candidates(spell, ctx, keys, weights, NULL, NULL,
+	    ncandidates, n, word);
+}
+
+/*
+ * Same as spell_get_corrections, for candidates in a candidate_buf. The
+ * counts and distances of the candidates are reused when all of them were
+ * added with add_match.
+ */
+static word_list *
+get_buffered_corrections(spell_t *spell, const candidate_buf *candidates, size_t n,
+    const char *word)
+{
+	spell_query_ctx *ctx = get_query_ctx();
+	int matched = candidates->nmatched == candidates->n;
+	char **keys;
+	size_t i;
+
+	keys = query_alloc(ctx, candidates->n * sizeof(*keys));
+	for (i = 0; i < candidates->n; i++)
+		keys[i] = candidate_word(candidates, i);
+	return rank_candidates(spell, ctx, keys, candidates->weights,
+	    matched ? candidates->counts : NULL,
+	    matched ? candidates->distances : NULL, candidates->n, n, word);
+}
+
+/*
+ * The factor edits1 weighs an edit by, for one which takes di characters
+ * of the word and puts dj in their place: a delete or a replace is worth
+ * a tenth of a transpose and an insert ten times as much, each a thousand
+ * times less at the first character.
+ */
+static float
+edit_factor(size_t di, size_t dj, int at_start)
+{
+	float factor = di == dj ? (di == 2 ? 1 : 0.1) : (di == 0 ? 10 : 0.1);
+
+	return at_start ? factor / 1000 : factor;
+}
+
+/*
+ * Keeps the cheaper of the ways into a cell of an alignment, with the
+ * larger factor of two equally cheap ones. An edit, taking di characters
+ * of the word and putting dj in their place, raises the factor of the
+ * way to its own when that is larger; a match leaves it as it is.
+ */
+static void
+align_step(const size_t *costs, const float *best, size_t from, size_t di,
+    size_t dj, int edit, int at_start, size_t *cost, float *factor)
+{
+	size_t c = costs[from] + (edit != 0);
+	float f = best[from];
+
+	if (edit)
+		f = fmaxf(f, edit_factor(di, dj, at_start));
+	if (c < *cost || (c == *cost && f > *factor)) {
+		*cost = c;
+		*factor = f;
+	}
+}
+
+/*
+ * Weighs a dictionary word found at distance from the len characters long
+ * word the way edits1 weighs the strings it generates. edits1 reaches it
+ * in distance edits and gives it 1 / distance times the factor of the
+ * last one, keeping the largest weight of all the ways there; since the
+ * edits can come in any order, that is the largest factor of an edit on
+ * any of the optimal OSA alignments of word to candidate, which is what
+ * is worked out here along with the alignments. costs and best must have
+ * room for (len + 1) * (strlen(candidate) + 1) entries.
+ */
+static float
+alignment_weight(const char *word, size_t len, const char *candidate,
+    size_t distance, size_t *costs, float *best)
+{
+	size_t clen = strlen(candidate), w = clen + 1, i, j, k;
+
+	costs[0] = 0;
+	best[0] = 0;
+	for (i = 0; i <= len; i++) {
+		for (j = i == 0; j <= clen; j++) {
+			k = i * w + j;
+			costs[k] = SIZE_MAX;
+			best[k] = 0;
+			if (i > 0 && j > 0)
+				align_step(costs, best, k - w - 1, 1, 1,
+				    word[i - 1] != candidate[j - 1], k == w + 1,
+				    &costs[k], &best[k]);
+			if (i > 0)
+				align_step(costs, best, k - w, 1, 0, 1, k == w,
+				    &costs[k], &best[k]);
+			if (j > 0)
+				align_step(costs, best, k - 1, 0, 1, 1, k == 1,
+				    &costs[k], &best[k]);
+			if (i > 1 && j > 1 && word[i - 1] == candidate[j - 2] &&
+			    word[i - 2] == candidate[j - 1] &&
+			    word[i - 1] != word[i - 2])
+				align_step(costs, best, k - 2 * w - 2, 2, 2, 1,
+				    k == 2 * w + 2, &costs[k], &best[k]);
+		}
+	}
+	return best[len * w + clen] / distance;
+}
+
+/*
+ * Carves out of the arena of ctx room for alignment_weight to align the
+ * len characters long word with candidates of up to maxlen characters.
+ */
+static void
+alloc_alignment(spell_query_ctx *ctx, size_t len, size_t maxlen,
+    size_t **costs, float **best)
+{
+	size_t ncells = (len + 1) * (maxlen + 1);
+
+	*costs = query_alloc(ctx, ncells * sizeof(**costs));
+	*best = query_alloc(ctx, ncells * sizeof(**best));
+}
+
+/*
+ * Appends to out the candidates at a distance of at most 2 from word.
+ * With a trie backed dictionary they come straight out of a bounded walk
+ * of the trie, so every one of them is a real word, weighted from its
+ * alignment with word as edits1 would have weighed it; otherwise every
+ * string at distance 1 from word is generated into steps and the
+ * dictionary words at distance 1 from those are kept.
+ */
+static void
+get_distance2_candidates(spell_t *spell, const char *word, candidate_buf *steps,
+    candidate_buf *out)
+{
+	trie_match *matches;
+	size_t nmatches, i, len, maxlen = 0, *costs;
+	float weight, *best;
+
+	if (spell->backend != SPELL_BACKEND_TRIE) {
+		clear_candidates(steps);
+		edits1(spell, word, 1, &dictionary_steps, steps);
+		edits_plus_one(spell, steps, &dictionary_words, out);
+		return;
+	}
+
+	matches = trie_fuzzy_search(spell->dictionary, word, 2, &nmatches);
+	if (matches == NULL)
+		return;
+
+	len = strlen(word);
+	for (i = 0; i < nmatches; i++)
+		if (strlen(matches[i].word) > maxlen)
+			maxlen = strlen(matches[i].word);
+	alloc_alignment(get_query_ctx(), len, maxlen, &costs, &best);
+	char word_soundex[METAPHONE_CODE_MAX];
+	metaphone_code(word, word_soundex);
+	for (i = 0; i < nmatches; i++) {
+		if (matches[i].distance == 0)
+			continue;
+		weight = alignment_weight(word, len, matches[i].word,
+		    matches[i].distance, costs, best);
+		if (same_metaphone(matches[i].word, strlen(matches[i].word), word_soundex))
+			weight *= 20;
+		add_match(out, matches[i].word, matches[i].count,
+		    matches[i].distance, weight);
+	}
+	free_trie_matches(matches, nmatches);
+}
+
+void
+free_list(char **list)
+{
+	size_t i = 0;
+	if (list == NULL)
+		return;
+
+	while (list[i] != NULL)
+		free(list[i++]);
+	free(list);
+}
+
+static int
+compare_listnodes(void *context, const void *node1, const void *node2)
+{
+	const word_list *wl1 = (const word_list *) node1;
+	const word_list *wl2 = (const word_list *) node2;
+
+	return strcmp(wl1->word, wl2->word);
+}
+
+static int
+parse_file_and_generate_tree(FILE *f, rb_tree_t *tree, char field_separator)
+{
+	if (f == NULL)
+		return -1;
+
+	char *word = NULL;
+	char *line = NULL;
+	long count;
+	size_t linesize = 0;
+	size_t wordsize = 0;
+	ssize_t bytes_read;
+	word_count *wcnode;
+	word_count wc;
+	wc.count = 0;
+	while ((bytes_read = getline(&line, &linesize, f)) != -1) {
+		line[bytes_read - 1] = 0;
+		char *templine = line;
+		if (field_separator) {
+			char *sepindex = strchr(templine, field_separator);
+			if (sepindex == NULL) {
+				free(line);
+				return -1;
+			}
+			sepindex[0] = 0;
+			count = strtol(sepindex + 1, NULL, 10);
+		} else
+			count = 1;
+
+		word = strdup(templine);
+		lower(word);
+		wcnode = malloc(sizeof(*wcnode));
+		wcnode->word = word;
+		wcnode->count = count;
+		rb_tree_insert_node(tree, wcnode);
+		free(line);
+		line = NULL;
+	}
+	free(line);
+	return 0;
+}
+
+typedef struct dict_entry {
+	char *word;
+	size_t count;
+	size_t seq;
+} dict_entry;
+
+typedef struct dict_entries {
+	dict_entry *entries;
+	size_t n;
+	size_t size;
+} dict_entries;
+
+/*
+ * Collects the words and their counts of a dictionary or whitelist file,
+ * so that the whole dictionary can be seen before the data structure
+ * holding it is built.
+ */
+static int
+parse_file_and_collect_entries(FILE *f, dict_entries *list, char field_separator)
+{
+	if (f == NULL)
+		return -1;
+
+	char *line = NULL;
+	size_t count;
+	size_t linesize = 0;
+	ssize_t bytes_read;
+	while ((bytes_read = getline(&line, &linesize, f)) != -1) {
+		line[bytes_read - 1] = 0;
+		char *templine = line;
+		if (field_separator) {
+			char *sepindex = strchr(templine, field_separator);
+			if (sepindex == NULL) {
+				free(line);
+				return -1;
+			}
+			sepindex[0] = 0;
+			count = strtol(sepindex + 1, NULL, 10);
+		} else
+			count = 1;
+
+		lower(templine);
+		if (list->n == list->size) {
+			list->size = list->size ? list->size * 2 : 1024;
+			list->entries = realloc(list->entries,
+			    list->size * sizeof(*list->entries));
+			if (list->entries == NULL)
+				err(EXIT_FAILURE, "malloc failed");
+		}
+		list->entries[list->n].word = strdup(templine);
+		list->entries[list->n].count = count;
+		list->entries[list->n].seq = list->n;
+		list->n++;
+	}
+	free(line);
+	return 0;
+}
+
+static int
+compare_entries(const void *e1, const void *e2)
+{
+	const dict_entry *d1 = (const dict_entry *) e1;
+	const dict_entry *d2 = (const dict_entry *) e2;
+	int retval = strcmp(d1->word, d2->word);
+
+	if (retval != 0)
+		return retval;
+	return d1->seq < d2->seq ? -1 : d1->seq > d2->seq;
+}
+
+/*
+ * Sorts the entries and drops the duplicates, keeping the one read last
+ * just like repeated trie_insert calls would.
+ */
+static void
+sort_entries(dict_entries *list)
+{
+	size_t i, n = 0;
+
+	qsort(list->entries, list->n, sizeof(*list->entries), compare_entries);
+	for (i = 0; i < list->n; i++) {
+		if (n > 0 && strcmp(list->entries[n - 1].word, list->entries[i].word) == 0) {
+			free(list->entries[n - 1].word);
+			list->entries[n - 1] = list->entries[i];
+		} else
+			list->entries[n++] = list->entries[i];
+	}
+	list->n = n;
+}
+
+static void
+free_entries(dict_entries *list)
+{
+	size_t i;
+
+	for (i = 0; i < list->n; i++)
+		free(list->entries[i].word);
+	free(list->entries);
+	list->entries = NULL;
+	list->n = list->size = 0;
+}
+
+/*
+ * Reads the whitelist and the dictionary into one sorted, duplicate free
+ * list of entries.
+ */
+static int
+read_dictionary_entries(const char *dictionary_path, const char *whitelist_filepath,
+    dict_entries *list)
+{
+	FILE *f;
+	int retval;
+
+	list->entries = NULL;
+	list->n = list->size = 0;
+	if (whitelist_filepath != NULL && (f = fopen(whitelist_filepath, "r")) != NULL) {
+		retval = parse_file_and_collect_entries(f, list, 0);
+		fclose(f);
+		if (retval < 0) {
+			free_entries(list);
+			return -1;
+		}
+	}
+
+	if ((f = fopen(dictionary_path, "r")) == NULL) {
+		free_entries(list);
+		return -1;
+	}
+	retval = parse_file_and_collect_entries(f, list, '\t');
+	fclose(f);
+	if (retval < 0) {
+		free_entries(list);
+		return -1;
+	}
+	sort_entries(list);
+	return 0;
+}
+
+/*
+ * The sorted, duplicate free words of the whitelist and the dictionary in
+ * parallel arrays, the form every backend is built from. keys owns the
+ * words.
+ */
+typedef struct dict_keys {
+	char **keys;
+	size_t *counts;
+	size_t n;
+} dict_keys;
+
+static int
+read_dictionary_keys(const char *dictionary_path, const char *whitelist_filepath,
+    dict_keys *dk)
+{
+	dict_entries list;
+	size_t i;
+
+	if (read_dictionary_entries(dictionary_path, whitelist_filepath, &list) < 0)
+		return -1;
+
+	dk->keys = malloc((list.n + 1) * sizeof(*dk->keys));
+	dk->counts = malloc((list.n + 1) * sizeof(*dk->counts));
+	if (dk->keys == NULL || dk->counts == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	for (i = 0; i < list.n; i++) {
+		dk->keys[i] = list.entries[i].word;
+		dk->counts[i] = list.entries[i].count;
+	}
+	dk->n = list.n;
+	free(list.entries);
+	return 0;
+}
+
+static void
+free_dictionary_keys(dict_keys *dk)
+{
+	size_t i;
+
+	for (i = 0; i < dk->n; i++)
+		free(dk->keys[i]);
+	free(dk->keys);
+	free(dk->counts);
+}
+
+/*
+ * Builds the trie from the sorted dictionary entries with
+ * trie_bulk_insert, which keeps the sibling lists balanced.
+ */
+static trie_t *
+generate_trie(const char *dictionary_path, const char *whitelist_filepath)
+{
+	dict_keys dk;
+	trie_t *trie;
+
+	if (read_dictionary_keys(dictionary_path, whitelist_filepath, &dk) < 0)
+		return NULL;
+	if ((trie = trie_init()) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	trie_bulk_insert(&trie, dk.keys, dk.counts, dk.n);
+	free_dictionary_keys(&dk);
+	return trie;
+}
+
+static dawg_t *
+generate_dawg(const char *dictionary_path, const char *whitelist_filepath)
+{
+	dict_keys dk;
+	dawg_t *dawg;
+
+	if (read_dictionary_keys(dictionary_path, whitelist_filepath, &dk) < 0)
+		return NULL;
+	dawg = dawg_build(dk.keys, dk.counts, dk.n);
+	free_dictionary_keys(&dk);
+	return dawg;
+}
+
+/*
+ * Builds the succinct trie from the dictionary. The parsed entries are
+ * only needed while building it, so the resident memory afterwards is
+ * the LOUDS arrays alone.
+ */
+static louds_t *
+generate_louds(const char *dictionary_path, const char *whitelist_filepath)
+{
+	dict_keys dk;
+	louds_t *louds;
+
+	if (read_dictionary_keys(dictionary_path, whitelist_filepath, &dk) < 0)
+		return NULL;
+	louds = louds_build(dk.keys, dk.counts, dk.n);
+	free_dictionary_keys(&dk);
+	return louds;
+}
+
+static art_t *
+generate_art(const char *dictionary_path, const char *whitelist_filepath)
+{
+	dict_keys dk;
+	art_t *art;
+	size_t i;
 
-		word = strdup(templine);
-		lower(word);
-		wcnode = malloc(sizeof(*wcnode));
-		wcnode->word = word;
-		wcnode->count = count;
-		rb_tree_insert_node(tree, wcnode);
-		free(line);
-		line = NULL;
-	}
-	free(line);
-	return 0;
+	if (read_dictionary_keys(dictionary_path, whitelist_filepath, &dk) < 0)
+		return NULL;
+	if ((art = art_init()) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	for (i = 0; i < dk.n; i++)
+		art_insert(art, dk.keys[i], dk.counts[i]);
+	free_dictionary_keys(&dk);
+	return art;
 }
 
 static wlist *
@@ -581,6 +1873,21 @@ get_wlist(const char *fname)
 	return w;
 }
 
+/*
+ * Adds the bigrams of spell to its known word filter
+ */
+static void
+filter_add_bigrams(spell_t *spell)
+{
+	word_count *wc;
+	uint32_t hashes[3];
+
+	RB_TREE_FOREACH(wc, spell->ngrams_tree) {
+		bloom_hash(wc->word, strlen(wc->word), BIGRAM_SEED, hashes);
+		bloom_add(spell->filter, hashes);
+	}
+}
+
 int
 load_bigrams(spell_t *spellt, const char *bigram_path)
 {
@@ -604,6 +1911,8 @@ load_bigrams(spell_t *spellt, const char *bigram_path)
 			return -1;
 		}
 		fclose(f);
+		if (spellt->filter != NULL)
+			filter_add_bigrams(spellt);
 	}
 
 }
@@ -657,8 +1966,21 @@ spell_init2(word_list *dictionary_list, word_list *whitelist)
 	spellt = malloc(sizeof(*spellt));
 	words_tree = trie_init();
 	spellt->dictionary = words_tree;
+	spellt->dawg = NULL;
+	spellt->art = NULL;
+	spellt->louds = NULL;
+	spellt->symspell = NULL;
+	spellt->pool = NULL;
+	spellt->cache = NULL;
+	spellt->filter = NULL;
+	spellt->hot = NULL;
+	spellt->alphabet = NULL;
+	spellt->code_alphabet = NULL;
+	spellt->rcu = spell_rcu_init();
+	spellt->backend = SPELL_BACKEND_TRIE;
 	spellt->ngrams_tree = NULL;
 	spellt->soundex_tree = NULL;
+	spellt->image = NULL;
 
 	char *word = NULL;
 	char *line = NULL;
@@ -717,22 +2039,47 @@ spell_init2(word_list *dictionary_list, word_list *whitelist)
 		}
 		node = node->next;
 	}
+	build_alphabets(spellt);
 	return spellt;
 }
 
 spell_t *
 spell_init(const char *dictionary_path, const char *whitelist_filepath)
+{
+	return spell_init_backend(dictionary_path, whitelist_filepath,
+	    SPELL_BACKEND_TRIE);
+}
+
+/*
+ * spell_init_backend--
+ *  Same as spell_init, but lets the caller pick the data structure which
+ *  holds the unigram dictionary, one of the SPELL_BACKEND_* constants.
+ */
+spell_t *
+spell_init_backend(const char *dictionary_path, const char *whitelist_filepath,
+    int backend)
 {
 	FILE *f;
 	spell_t *spellt;
-	trie_t *words_tree = NULL;
 	static rb_tree_t *soundex_tree;
 
 	spellt = malloc(sizeof(*spellt));
-	words_tree = trie_init();
-	spellt->dictionary = words_tree;
+	spellt->dictionary = NULL;
+	spellt->dawg = NULL;
+	spellt->art = NULL;
+	spellt->louds = NULL;
+	spellt->symspell = NULL;
+	spellt->pool = NULL;
+	spellt->cache = NULL;
+	spellt->filter = NULL;
+	spellt->hot = NULL;
+	spellt->alphabet = NULL;
+	spellt->code_alphabet = NULL;
+	spellt->rcu = spell_rcu_init();
+	spellt->backend = backend;
 	spellt->ngrams_tree = NULL;
 	spellt->soundex_tree = NULL;
+	spellt->image = NULL;
 
 	char *word = NULL;
 	char *line = NULL;
@@ -743,25 +2090,39 @@ spell_init(const char *dictionary_path, const char *whitelist_filepath)
 	word_count wc;
 	wc.count = 0;
 
-	if (whitelist_filepath != NULL && (f = fopen(whitelist_filepath, "r")) != NULL) {
-		if ((parse_file_and_generate_trie(f, words_tree, 0)) < 0) {
+	switch (backend) {
+	case SPELL_BACKEND_DAWG:
+		spellt->dawg = generate_dawg(dictionary_path, whitelist_filepath);
+		if (spellt->dawg == NULL) {
 			spell_destroy(spellt);
-			fclose(f);
 			return NULL;
 		}
-	}
-
-	if ((f = fopen(dictionary_path, "r")) == NULL) {
-		spell_destroy(spellt);
-		return NULL;
-	}
-
-	if ((parse_file_and_generate_trie(f, words_tree, '\t')) < 0) {
+		break;
+	case SPELL_BACKEND_ART:
+		spellt->art = generate_art(dictionary_path, whitelist_filepath);
+		if (spellt->art == NULL) {
+			spell_destroy(spellt);
+			return NULL;
+		}
+		break;
+	case SPELL_BACKEND_LOUDS:
+		spellt->louds = generate_louds(dictionary_path, whitelist_filepath);
+		if (spellt->louds == NULL) {
+			spell_destroy(spellt);
+			return NULL;
+		}
+		break;
+	case SPELL_BACKEND_TRIE:
+		spellt->dictionary = generate_trie(dictionary_path, whitelist_filepath);
+		if (spellt->dictionary == NULL) {
+			spell_destroy(spellt);
+			return NULL;
+		}
+		break;
+	default:
 		spell_destroy(spellt);
-		fclose(f);
 		return NULL;
 	}
-	fclose(f);
 
 	if ((f = fopen("dict/soundex.txt", "r")) != NULL) {
 		static const rb_tree_ops_t soundex_tree_ops = {
@@ -816,9 +2177,305 @@ spell_init(const char *dictionary_path, const char *whitelist_filepath)
 		fclose(f);
 	}
 	free(line);
+	build_alphabets(spellt);
+	return spellt;
+}
+
+static int
+write_block(FILE *f, const void *data, size_t size, uint64_t *offset)
+{
+	if (size != 0 && fwrite(data, size, 1, f) != 1)
+		return -1;
+	*offset += size;
+	return 0;
+}
+
+static int
+write_image(spell_t *spell, const char *path)
+{
+	FILE *f;
+	spell_image_header header;
+	spell_image_code *codes = NULL;
+	char *strings = NULL;
+	size_t ncodes = 0, codes_size = 0;
+	size_t strings_len = 0, strings_size = 0;
+	uint64_t offset = 0;
+	word_list *bucket, *node;
+	size_t len;
+	int retval = -1;
+
+	if (spell == NULL || spell->dictionary == NULL || path == NULL)
+		return -1;
+
+#define POOL_APPEND(s) do {						\
+	len = strlen(s) + 1;						\
+	if (strings_len + len > strings_size) {				\
+		strings_size = (strings_size + len) * 2;		\
+		strings = realloc(strings, strings_size);		\
+		if (strings == NULL)					\
+			err(EXIT_FAILURE, "malloc failed");		\
+	}								\
+	memcpy(strings + strings_len, s, len);				\
+	strings_len += len;						\
+} while (0)
+
+	if (spell->soundex_tree != NULL) {
+		RB_TREE_FOREACH(bucket, spell->soundex_tree) {
+			if (ncodes == codes_size) {
+				codes_size = codes_size ? codes_size * 2 : 1024;
+				codes = realloc(codes, codes_size * sizeof(*codes));
+				if (codes == NULL)
+					err(EXIT_FAILURE, "malloc failed");
+			}
+			codes[ncodes].code = strings_len;
+			POOL_APPEND(bucket->word);
+			codes[ncodes].words = strings_len;
+			codes[ncodes].nwords = 0;
+			for (node = bucket->next; node != NULL; node = node->next) {
+				POOL_APPEND(node->word);
+				codes[ncodes].nwords++;
+			}
+			ncodes++;
+		}
+	}
+#undef POOL_APPEND
+
+	if (strings_len > UINT32_MAX) {
+		warnx("phonetic index too large for %s", path);
+		goto out;
+	}
+
+	if ((f = fopen(path, "w")) == NULL) {
+		warn("Failed to open %s for writing", path);
+		goto out;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SPELL_IMAGE_MAGIC, sizeof(header.magic));
+	header.version = SPELL_IMAGE_VERSION;
+	header.nnodes = spell->dictionary->nnodes;
+	header.ncodes = ncodes;
+	header.nodes_offset = sizeof(header);
+	header.codes_offset = header.nodes_offset +
+	    (uint64_t) header.nnodes * sizeof(trie_node_t);
+	header.strings_offset = header.codes_offset +
+	    (uint64_t) ncodes * sizeof(*codes);
+	header.strings_size = strings_len;
+
+	if (write_block(f, &header, sizeof(header), &offset) < 0 ||
+	    write_block(f, spell->dictionary->nodes,
+		header.nnodes * sizeof(trie_node_t), &offset) < 0 ||
+	    write_block(f, codes, ncodes * sizeof(*codes), &offset) < 0 ||
+	    write_block(f, strings, strings_len, &offset) < 0) {
+		warn("Failed to write %s", path);
+		fclose(f);
+		goto out;
+	}
+	assert(offset == header.strings_offset + strings_len);
+	if (fclose(f) != 0) {
+		warn("Failed to write %s", path);
+		goto out;
+	}
+	retval = 0;
+out:
+	free(codes);
+	free(strings);
+	return retval;
+}
+
+/*
+ * spell_write_image--
+ *  Dumps the dictionary trie and the phonetic index of spell into a
+ *  binary image at path, which spell_open_image() can later map without
+ *  doing any parsing. Only SPELL_BACKEND_TRIE dictionaries can be saved.
+ */
+int
+spell_write_image(spell_t *spell, const char *path)
+{
+	spell_t view;
+	unsigned int idx = spell_read_lock(spell, &view);
+	int retval = write_image(&view, path);
+
+	spell_read_unlock(spell, idx);
+	return retval;
+}
+
+/*
+ * Checks the links of the nodes and the offsets of the phonetic index of
+ * an image whose header is known to be sound, so that no query can read
+ * outside of it. The trie only ever links a node to one created after it,
+ * which also rules out cycles.
+ */
+static int
+image_is_valid(const spell_image_header *header, const char *base)
+{
+	const trie_node_t *nodes = (const trie_node_t *) (base + header->nodes_offset);
+	const spell_image_code *codes = (const spell_image_code *) (base +
+	    header->codes_offset);
+	const char *strings = base + header->strings_offset;
+	uint64_t offset;
+	uint32_t i, j, links[3];
+	int k;
+
+	for (i = 0; i < header->nnodes; i++) {
+		links[0] = nodes[i].left;
+		links[1] = nodes[i].middle;
+		links[2] = nodes[i].right;
+		for (k = 0; k < 3; k++)
+			if (links[k] != TRIE_NIL &&
+			    (links[k] <= i || links[k] >= header->nnodes))
+				return 0;
+	}
+
+	/* The pool ends with a NUL, so every string in it is terminated */
+	for (i = 0; i < header->ncodes; i++) {
+		if (codes[i].code >= header->strings_size)
+			return 0;
+		if (i > 0 && strcmp(strings + codes[i - 1].code,
+		    strings + codes[i].code) >= 0)
+			return 0;
+		offset = codes[i].words;
+		for (j = 0; j < codes[i].nwords; j++) {
+			if (offset >= header->strings_size)
+				return 0;
+			offset += strlen(strings + offset) + 1;
+		}
+	}
+	return 1;
+}
+
+/*
+ * spell_open_image--
+ *  Maps a dictionary image generated by spell_write_image() read-only and
+ *  serves queries straight out of it. Processes mapping the same image
+ *  share its pages through the page cache. Every link and offset in the
+ *  image is checked once here, and an image failing any check is
+ *  rejected.
+ */
+spell_t *
+spell_open_image(const char *path)
+{
+	struct stat sb;
+	spell_t *spellt;
+	struct spell_image *image;
+	const spell_image_header *header;
+	void *base;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return NULL;
+	if (fstat(fd, &sb) == -1 || (size_t) sb.st_size < sizeof(*header)) {
+		close(fd);
+		return NULL;
+	}
+	base = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	header = base;
+	if (memcmp(header->magic, SPELL_IMAGE_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->version != SPELL_IMAGE_VERSION ||
+	    header->nnodes == 0 ||
+	    header->nodes_offset != sizeof(*header) ||
+	    header->codes_offset != header->nodes_offset +
+		(uint64_t) header->nnodes * sizeof(trie_node_t) ||
+	    header->strings_offset != header->codes_offset +
+		(uint64_t) header->ncodes * sizeof(spell_image_code) ||
+	    header->strings_offset + header->strings_size != (uint64_t) sb.st_size ||
+	    (header->strings_size != 0 &&
+		((const char *) base)[sb.st_size - 1] != 0) ||
+	    !image_is_valid(header, base)) {
+		warnx("%s: not a valid dictionary image", path);
+		munmap(base, sb.st_size);
+		return NULL;
+	}
+
+	spellt = malloc(sizeof(*spellt));
+	image = malloc(sizeof(*image));
+	if (spellt == NULL || image == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	image->base = base;
+	image->size = sb.st_size;
+	image->codes = (const spell_image_code *) ((const char *) base +
+	    header->codes_offset);
+	image->ncodes = header->ncodes;
+	image->strings = (const char *) base + header->strings_offset;
+
+	spellt->dictionary = trie_map((trie_node_t *) ((char *) base +
+	    header->nodes_offset), header->nnodes);
+	spellt->dawg = NULL;
+	spellt->art = NULL;
+	spellt->louds = NULL;
+	spellt->symspell = NULL;
+	spellt->pool = NULL;
+	spellt->cache = NULL;
+	spellt->filter = NULL;
+	spellt->hot = NULL;
+	spellt->alphabet = NULL;
+	spellt->code_alphabet = NULL;
+	spellt->rcu = spell_rcu_init();
+	spellt->backend = SPELL_BACKEND_TRIE;
+	spellt->ngrams_tree = NULL;
+	spellt->soundex_tree = NULL;
+	spellt->image = image;
+	build_alphabets(spellt);
 	return spellt;
 }
 
+/*
+ * Binary search for a metaphone code in the phonetic index of an image
+ */
+static const spell_image_code *
+image_find_code(struct spell_image *image, const char *code)
+{
+	size_t lo = 0, hi = image->ncodes, mid;
+	int cmp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = strcmp(image->strings + image->codes[mid].code, code);
+		if (cmp == 0)
+			return &image->codes[mid];
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+/*
+ * Returns the bucket of a metaphone code in an image, as a list allocated
+ * from the arena of ctx whose words point into the image.
+ */
+static word_list *
+image_get_bucket(spell_query_ctx *ctx, struct spell_image *image, const char *code)
+{
+	const spell_image_code *bucket = image_find_code(image, code);
+	const char *word;
+	word_list *head = NULL, *tail = NULL, *node;
+	size_t i;
+
+	if (bucket == NULL)
+		return NULL;
+
+	word = image->strings + bucket->words;
+	for (i = 0; i < bucket->nwords; i++) {
+		node = query_alloc(ctx, sizeof(*node));
+		node->word = (char *) word;
+		node->weight = .01;
+		node->next = NULL;
+		if (tail == NULL)
+			head = node;
+		else
+			tail->next = node;
+		tail = node;
+		word += strlen(word) + 1;
+	}
+	return head;
+}
+
 char *
 soundex(const char *word)
 {
@@ -928,152 +2585,381 @@ soundex(const char *word)
 	return soundex_code;
 }
 
+/*
+ * Copies the nodes of list into the arena of ctx. The words are shared
+ * with list, so the copy is only good while the dictionary is locked.
+ */
 static word_list *
-copy_word_list(word_list * list)
+copy_word_list(spell_query_ctx *ctx, const word_list *list)
 {
-	if (list == NULL)
-		return NULL;
+	word_list *head = NULL, *tail = NULL, *node;
 
-	word_list *newnode;
-	word_list *tail = NULL;
-	word_list *head = NULL;
-	word_list *tempnode = list;
-	while (tempnode != NULL) {
-		newnode = malloc(sizeof(*newnode));
-		newnode->word = strdup(tempnode->word);
-		newnode->weight = tempnode->weight;
-		newnode->next = NULL;
-		if (head == NULL)
-			head = newnode;
+	for (; list != NULL; list = list->next) {
+		node = query_alloc(ctx, sizeof(*node));
+		node->word = list->word;
+		node->weight = list->weight;
+		node->next = NULL;
 		if (tail == NULL)
-			tail = newnode;
-		else {
-			tail->next = newnode;
-			tail = newnode;
-		}
-		tempnode = tempnode->next;
+			head = node;
+		else
+			tail->next = node;
+		tail = node;
 	}
 	return head;
 }
 
+/*
+ * Returns a copy of the dictionary words filed under the given metaphone
+ * code, from either the in-memory phonetic index or a mapped image. The
+ * copy lives in the arena of the query.
+ */
 static word_list *
-get_soundex2_list(spell_t *spell, char *word)
+get_phonetic_bucket(spell_t *spell, const char *code)
 {
-	word_list soundex_node;
-	word_list *soundexes = NULL;
-	word_list *temp;
-	char *soundex_code = double_metaphone(word);
-	if (soundex_code == NULL)
+	word_list node;
+	word_list *bucket;
+
+	if (spell->image != NULL)
+		return image_get_bucket(get_query_ctx(), spell->image, code);
+	if (spell->soundex_tree == NULL)
 		return NULL;
 
-	word_list *distance_one_mphones = edits1(soundex_code, 1);
-	free(soundex_code);
+	node.word = (char *) code;
+	bucket = rb_tree_find_node(spell->soundex_tree, &node);
+	return bucket != NULL ? copy_word_list(get_query_ctx(), bucket->next) : NULL;
+}
+
+static int
+has_phonetic_bucket(spell_t *spell, const char *code)
+{
+	word_list node;
+
+	if (spell->image != NULL)
+		return image_find_code(spell->image, code) != NULL;
+	if (spell->soundex_tree == NULL)
+		return 0;
+
+	node.word = (char *) code;
+	return rb_tree_find_node(spell->soundex_tree, &node) != NULL;
+}
+
+static size_t
+common_prefix_len(const char *s1, const char *s2)
+{
+	size_t len = 0;
+
+	while (s1[len] != 0 && s1[len] == s2[len])
+		len++;
+	return len;
+}
+
+/*
+ * The codes of the phonetic index are kept sorted, so the code sharing
+ * the longest prefix with code is one of the two it would sit between.
+ */
+static size_t
+phonetic_prefix_len(spell_t *spell, const char *code)
+{
+	struct spell_image *image = spell->image;
+	size_t lo, hi, mid, len = 0, len2;
+	word_list node;
+	const word_list *next, *prev;
+
+	if (image != NULL) {
+		lo = 0;
+		hi = image->ncodes;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (strcmp(image->strings + image->codes[mid].code, code) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo < image->ncodes)
+			len = common_prefix_len(code,
+			    image->strings + image->codes[lo].code);
+		if (lo > 0) {
+			len2 = common_prefix_len(code,
+			    image->strings + image->codes[lo - 1].code);
+			if (len2 > len)
+				len = len2;
+		}
+		return len;
+	}
+	if (spell->soundex_tree == NULL)
+		return 0;
+
+	node.word = (char *) code;
+	next = rb_tree_find_node_geq(spell->soundex_tree, &node);
+	prev = rb_tree_find_node_leq(spell->soundex_tree, &node);
+	if (next != NULL)
+		len = common_prefix_len(code, next->word);
+	if (prev != NULL) {
+		len2 = common_prefix_len(code, prev->word);
+		if (len2 > len)
+			len = len2;
+	}
+	return len;
+}
+
+static const struct spell_alphabet *
+phonetic_alphabet(spell_t *spell)
+{
+	return spell->code_alphabet;
+}
+
+static const candidate_filter phonetic_codes = {
+	has_phonetic_bucket, phonetic_prefix_len, phonetic_alphabet
+};
+
+static const candidate_filter phonetic_steps = {
+	NULL, NULL, phonetic_alphabet
+};
+
+/*
+ * Appends to soundexes the words of the phonetic buckets of the codes in
+ * codes.
+ */
+static word_list *
+get_phonetic_buckets(spell_t *spell, const candidate_buf *codes, word_list *soundexes)
+{
+	word_list *soundexes1;
+	size_t i;
 
-	word_list *distance_two_mphones = edits_plus_one(distance_one_mphones);
-	word_list *node = distance_two_mphones;
-	if (node == NULL)
-		warnx("node null for word %s", word);
-	while (node->next != NULL) {
-		soundex_node.word = node->word;
-		word_list *soundexes1 = rb_tree_find_node(spell->soundex_tree, &soundex_node);
+	for (i = 0; i < codes->n; i++) {
+		soundexes1 = get_phonetic_bucket(spell, candidate_word(codes, i));
 		if (soundexes1 != NULL) {
 			if (soundexes == NULL)
-				soundexes = copy_word_list(soundexes1->next);
+				soundexes = soundexes1;
 			else
-				append_word_list(soundexes, copy_word_list(soundexes1->next));
+				append_word_list(soundexes, soundexes1);
 		}
-		node = node->next;
 	}
-	free_word_list(distance_one_mphones);
-	free_word_list(distance_two_mphones);
 	return soundexes;
 }
 
+static word_list *
+get_soundex2_list(spell_t *spell, char *word)
+{
+	spell_query_ctx *ctx = get_query_ctx();
+	char soundex_code[METAPHONE_CODE_MAX];
+
+	metaphone_code(word, soundex_code);
+	clear_candidates(&ctx->codes[0]);
+	clear_candidates(&ctx->codes[1]);
+	edits1(spell, soundex_code, 1, &phonetic_steps, &ctx->codes[0]);
+	edits_plus_one(spell, &ctx->codes[0], &phonetic_codes, &ctx->codes[1]);
+	return get_phonetic_buckets(spell, &ctx->codes[1], NULL);
+}
+
 static word_list *
 get_soundex_list(spell_t *spell, char *word)
 {
-	word_list soundex_node;
-	word_list *soundexes = NULL;
-	word_list *temp;
-	char *soundex_code = double_metaphone(word);
-	if (soundex_code == NULL)
-		return NULL;
+	spell_query_ctx *ctx = get_query_ctx();
+	char soundex_code[METAPHONE_CODE_MAX];
+
+	metaphone_code(word, soundex_code);
+	clear_candidates(&ctx->codes[0]);
+	edits1(spell, soundex_code, 1, &phonetic_codes, &ctx->codes[0]);
+	return get_phonetic_buckets(spell, &ctx->codes[0],
+	    get_phonetic_bucket(spell, soundex_code));
+}
+
+static int
+is_known_word(spell_t *spell, const char *word, int ngram)
+{
+	if (ngram == 1)
+//		return look((u_char *) word, (u_char *)spell->dictionary->front, (u_char *)spell->dictionary->back) != 0;
+		return dictionary_get(spell, word) != 0;
+	else if (ngram == 2) {
+		word_count wc;
+		wc.word = (char *) word;
+		word_count *node = rb_tree_find_node(spell->ngrams_tree, &wc);
+		return node != NULL? node->count: 0;
+	}
+	return 0;
+}
+
+/*
+ * With a filter most misspellings are turned down without even taking the
+ * read lock, as the filter only ever gains bits. The most frequent words
+ * are then confirmed by the hot set of the version read, without walking
+ * the dictionary.
+ */
+int
+spell_is_known_word(spell_t *spell, const char *word, int ngram)
+{
+	spell_t view;
+	unsigned int idx;
+	uint32_t hashes[3];
+	int known;
+
+	/* The hot set is probed with the same hashes as the filter */
+	bloom_hash(word, strlen(word), ngram == 2 ? BIGRAM_SEED : UNIGRAM_SEED,
+	    hashes);
+	if (spell->filter != NULL && !bloom_test(spell->filter, hashes))
+		return 0;
+	idx = spell_read_lock(spell, &view);
+	if (view.hot != NULL && ngram == 1 && hot_find(view.hot, word, hashes))
+		known = 1;
+	else
+		known = is_known_word(&view, word, ngram);
+
+	spell_read_unlock(spell, idx);
+	return known;
+}
+
+/*
+ * The suggestion functions whose results are cached, told apart in the
+ * keys of the cache.
+ */
+#define QUERY_SLOW	's'
+#define QUERY_FAST	'f'
+#define QUERY_SYMSPELL	'y'
+
+typedef word_list *(*suggest_fn)(spell_t *, char *, size_t);
+
+/*
+ * Packs the words of list back to back, each NUL terminated, into the
+ * arena of the query.
+ */
+static char *
+pack_word_list(spell_query_ctx *ctx, const word_list *list, size_t *len)
+{
+	const word_list *nodep;
+	char *packed, *p;
+	size_t size;
+
+	*len = 0;
+	for (nodep = list; nodep != NULL; nodep = nodep->next)
+		*len += strlen(nodep->word) + 1;
+	packed = p = query_alloc(ctx, *len);
+	for (nodep = list; nodep != NULL; nodep = nodep->next) {
+		size = strlen(nodep->word) + 1;
+		memcpy(p, nodep->word, size);
+		p += size;
+	}
+	return packed;
+}
+
+static word_list *
+unpack_word_list(const char *packed, size_t len)
+{
+	const char *end = packed + len;
+	word_list *head = NULL, *tail = NULL, *node;
+
+	for (; packed < end; packed += strlen(packed) + 1) {
+		node = malloc(sizeof(*node));
+		if (node == NULL || (node->word = strdup(packed)) == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+		node->weight = 0;
+		node->next = NULL;
+		if (tail == NULL)
+			head = node;
+		else
+			tail->next = node;
+		tail = node;
+	}
+	return head;
+}
+
+/*
+ * Runs the query suggest on a read side view of spell, through its cache
+ * if it has one. The cache is keyed by the query, nsuggestions and the
+ * lowercased word, and remembers misses as well as suggestions. The
+ * suggestions are copied out of the query context for the caller either
+ * way.
+ */
+static word_list *
+cached_suggestions(spell_t *spell, suggest_fn suggest, char query, char *word,
+    size_t nsuggestions)
+{
+	spell_t view;
+	unsigned int idx;
+	spell_query_ctx *ctx = get_query_ctx();
+	word_list *corrections;
+	char *key = NULL, *value;
+	size_t keylen, valuelen;
 
-	soundex_node.word = soundex_code;
-	soundexes = rb_tree_find_node(spell->soundex_tree, &soundex_node);
-	if (soundexes) {
-		temp = copy_word_list(soundexes->next);
-		soundexes = temp;
-	}
-	word_list *distance_one_mphones = edits1(soundex_code, 1);
-	word_list *node = distance_one_mphones;
-	if (node == NULL)
-		warnx("node null for word %s", word);
-	while (node->next != NULL) {
-		soundex_node.word = node->word;
-		word_list *soundexes1 = rb_tree_find_node(spell->soundex_tree, &soundex_node);
-		if (soundexes1 != NULL) {
-			if (soundexes == NULL)
-				soundexes = copy_word_list(soundexes1->next);
-			else
-				append_word_list(soundexes, copy_word_list(soundexes1->next));
+	/* No word is that long, and the edits of one would not fit the stack */
+	if (word != NULL && strlen(word) > TRIE_MAX_WORD)
+		return NULL;
+	idx = spell_read_lock(spell, &view);
+	if (view.cache != NULL && word != NULL) {
+		lower(word);
+		keylen = 1 + sizeof(nsuggestions) + strlen(word);
+		key = query_alloc(ctx, keylen);
+		key[0] = query;
+		memcpy(key + 1, &nsuggestions, sizeof(nsuggestions));
+		memcpy(key + 1 + sizeof(nsuggestions), word, keylen - 1 - sizeof(nsuggestions));
+		if (cache_get(view.cache, key, keylen, &value, &valuelen)) {
+			corrections = unpack_word_list(value, valuelen);
+			free(value);
+			query_reset(ctx);
+			spell_read_unlock(spell, idx);
+			return corrections;
 		}
-		node = node->next;
 	}
-	free(soundex_code);
 
-	free_word_list(distance_one_mphones);
-	return soundexes;
+	corrections = suggest(&view, word, nsuggestions);
+	value = pack_word_list(ctx, corrections, &valuelen);
+	if (key != NULL)
+		cache_put(view.cache, key, keylen, value, valuelen);
+	corrections = unpack_word_list(value, valuelen);
+	query_reset(ctx);
+	spell_read_unlock(spell, idx);
+	return corrections;
 }
 
+/*
+ * spell_set_cache--
+ *  Keeps the suggestions of up to about nentries misspellings, so that
+ *  looking the same one up again is a single hash lookup; 0 turns the
+ *  cache off. Adding words to the dictionary empties it. Call it before
+ *  spell is shared between threads.
+ */
 int
-spell_is_known_word(spell_t *spell, const char *word, int ngram)
+spell_set_cache(spell_t *spell, size_t nentries)
 {
-	if (ngram == 1)
-//		return look((u_char *) word, (u_char *)spell->dictionary->front, (u_char *)spell->dictionary->back) != 0;
-		return trie_get(spell->dictionary, word) != 0;
-	else if (ngram == 2) {
-		word_count wc;
-		wc.word = (char *) word;
-		word_count *node = rb_tree_find_node(spell->ngrams_tree, &wc);
-		return node != NULL? node->count: 0;
-	}
+	cache_destroy(spell->cache);
+	spell->cache = cache_init(nentries);
 	return 0;
 }
 
-word_list *
-spell_get_suggestions_slow(spell_t * spell, char *word, size_t nsuggestions)
+/*
+ * spell_get_cache_stats--
+ *  Fills stats with the hits and misses of the suggestion cache so far,
+ *  all zero when spell has none.
+ */
+void
+spell_get_cache_stats(spell_t *spell, cache_stats *stats)
+{
+	cache_get_stats(spell->cache, stats);
+}
+
+static word_list *
+get_suggestions_slow(spell_t * spell, char *word, size_t nsuggestions)
 {
+	spell_query_ctx *ctx = get_query_ctx();
 	word_list *corrections = NULL;
-	word_list *candidates;
-	word_list *candidates2;
 	word_list *soundexes = NULL;
-	word_list *tail;
 	if (word == NULL)
 		return NULL;
 	lower(word);
-	candidates = edits1(word, 1);
-	corrections = spell_get_corrections(spell, candidates, nsuggestions, word);
+	clear_candidates(&ctx->edits[0]);
+	edits1(spell, word, 1, &dictionary_words, &ctx->edits[0]);
+	corrections = get_buffered_corrections(spell, &ctx->edits[0], nsuggestions, word);
 
 	if (corrections == NULL) {
-		candidates2 = edits_plus_one(candidates);
-		if (soundexes) {
-			append_word_list(soundexes, candidates2);
-			corrections = spell_get_corrections(spell, soundexes, nsuggestions, word);
-			free_word_list(soundexes);
-		} else {
-			corrections = spell_get_corrections(spell, candidates2, nsuggestions, word);
-		}
-		free_word_list(candidates2);
+		clear_candidates(&ctx->edits[1]);
+		get_distance2_candidates(spell, word, &ctx->edits[0], &ctx->edits[1]);
+		corrections = get_buffered_corrections(spell, &ctx->edits[1], nsuggestions, word);
 	}
 
-	free_word_list(candidates);
 	if (corrections == NULL) {
 		soundexes = get_soundex_list(spell, word);
 		if (soundexes != NULL) {
 			corrections = spell_get_corrections(spell, soundexes, nsuggestions, word);
-			free_word_list(soundexes);
-			soundexes = NULL;
 		}
 	}
 
@@ -1081,57 +2967,186 @@ spell_get_suggestions_slow(spell_t * spell, char *word, size_t nsuggestions)
 		soundexes = get_soundex2_list(spell, word);
 		if (soundexes) {
 			corrections = spell_get_corrections(spell, soundexes, nsuggestions, word);
-			free_word_list(soundexes);
 		}
 	}
 	return corrections;
 }
 
 word_list *
-spell_get_suggestions_fast(spell_t * spell, char *word, size_t nsuggestions)
+spell_get_suggestions_slow(spell_t *spell, char *word, size_t nsuggestions)
+{
+	return cached_suggestions(spell, get_suggestions_slow, QUERY_SLOW, word,
+	    nsuggestions);
+}
+
+static word_list *
+get_suggestions_fast(spell_t * spell, char *word, size_t nsuggestions)
 {
+	spell_query_ctx *ctx = get_query_ctx();
 	word_list *corrections = NULL;
-	word_list *candidates;
-	word_list *candidates2;
 	word_list *soundexes = NULL;
-	word_list *tail;
 	lower(word);
-	candidates = edits1(word, 1);
-	corrections = spell_get_corrections(spell, candidates, nsuggestions, word);
+	clear_candidates(&ctx->edits[0]);
+	edits1(spell, word, 1, &dictionary_words, &ctx->edits[0]);
+	corrections = get_buffered_corrections(spell, &ctx->edits[0], nsuggestions, word);
 
 	if (corrections == NULL) {
 		soundexes = get_soundex_list(spell, word);
 		if (soundexes != NULL) {
 			corrections = spell_get_corrections(spell, soundexes, nsuggestions, word);
-			free_word_list(soundexes);
-			soundexes = NULL;
 		}
 
 	}
 
 	if (corrections == NULL) {
-		candidates2 = edits_plus_one(candidates);
+		clear_candidates(&ctx->edits[1]);
+		get_distance2_candidates(spell, word, &ctx->edits[0], &ctx->edits[1]);
+		corrections = get_buffered_corrections(spell, &ctx->edits[1], nsuggestions, word);
+	}
+
+	if (corrections == NULL) {
+		soundexes = get_soundex2_list(spell, word);
 		if (soundexes) {
-			append_word_list(soundexes, candidates2);
 			corrections = spell_get_corrections(spell, soundexes, nsuggestions, word);
-			free_word_list(soundexes);
-		} else {
-			corrections = spell_get_corrections(spell, candidates2, nsuggestions, word);
 		}
-		free_word_list(candidates2);
-		free_word_list(candidates);
+	}
+	return corrections;
+}
+
+word_list *
+spell_get_suggestions_fast(spell_t *spell, char *word, size_t nsuggestions)
+{
+	return cached_suggestions(spell, get_suggestions_fast, QUERY_FAST, word,
+	    nsuggestions);
+}
+
+/*
+ * spell_load_symspell--
+ *  Builds the symmetric delete index used by
+ *  spell_get_suggestions_symspell from the same files spell_init takes.
+ *  maxdist is the largest edit distance of a suggestion. Only the first
+ *  prefixlen characters of the words are indexed. Lower values of either
+ *  take less memory. Call it before spell is shared between threads.
+ *  Words added later with spell_add_words are not indexed.
+ */
+int
+spell_load_symspell(spell_t *spell, const char *dictionary_path,
+    const char *whitelist_filepath, unsigned int maxdist, unsigned int prefixlen)
+{
+	dict_keys dk;
+
+	if (read_dictionary_keys(dictionary_path, whitelist_filepath, &dk) < 0)
+		return -1;
+	symspell_destroy(spell->symspell);
+	spell->symspell = symspell_build(dk.keys, dk.counts, dk.n, maxdist, prefixlen);
+	free_dictionary_keys(&dk);
+	return spell->symspell == NULL ? -1 : 0;
+}
+
+/*
+ * spell_set_threads--
+ *  Lets the queries of spell share their distance 2 expansions out to
+ *  nthreads threads, the calling one included; 1 goes back to running
+ *  them on the calling thread alone. The suggestions do not depend on the
+ *  number of threads. The pool runs the expansion of one query at a time,
+ *  the others run theirs on their own thread meanwhile. Call it before
+ *  spell is shared between threads.
+ */
+int
+spell_set_threads(spell_t *spell, size_t nthreads)
+{
+	workpool_destroy(spell->pool);
+	spell->pool = NULL;
+	if (nthreads <= 1)
+		return 0;
+	spell->pool = workpool_init(nthreads);
+	return spell->pool == NULL ? -1 : 0;
+}
+
+/*
+ * Appends to out the symmetric delete matches at a distance between
+ * mindist and maxdist, weighted like those of get_distance2_candidates.
+ */
+static void
+symspell_candidates(const symspell_match *matches, size_t nmatches,
+    const char *word, size_t mindist, size_t maxdist, candidate_buf *out)
+{
+	char word_soundex[METAPHONE_CODE_MAX];
+	float weight, *best;
+	size_t i, len = strlen(word), maxlen = 0, *costs;
+
+	for (i = 0; i < nmatches; i++)
+		if (strlen(matches[i].word) > maxlen)
+			maxlen = strlen(matches[i].word);
+	alloc_alignment(get_query_ctx(), len, maxlen, &costs, &best);
+	metaphone_code(word, word_soundex);
+	for (i = 0; i < nmatches; i++) {
+		if (matches[i].distance < mindist || matches[i].distance > maxdist)
+			continue;
+		weight = alignment_weight(word, len, matches[i].word,
+		    matches[i].distance, costs, best);
+		if (same_metaphone(matches[i].word, strlen(matches[i].word), word_soundex))
+			weight *= 20;
+		add_match(out, matches[i].word, matches[i].count,
+		    matches[i].distance, weight);
+	}
+}
+
+/*
+ * Like get_suggestions_fast, but the candidates come from the symmetric
+ * delete index: only the deletes of word are generated and every
+ * candidate is a dictionary word, so nothing is built at distance 2.
+ */
+static word_list *
+get_suggestions_symspell(spell_t *spell, char *word, size_t nsuggestions)
+{
+	spell_query_ctx *ctx;
+	word_list *corrections = NULL;
+	word_list *soundexes;
+	symspell_match *matches;
+	size_t nmatches;
+
+	if (spell->symspell == NULL)
+		return get_suggestions_fast(spell, word, nsuggestions);
+
+	ctx = get_query_ctx();
+	lower(word);
+	matches = symspell_lookup(spell->symspell, word, &nmatches);
+	clear_candidates(&ctx->edits[0]);
+	symspell_candidates(matches, nmatches, word, 1, 1, &ctx->edits[0]);
+	corrections = get_buffered_corrections(spell, &ctx->edits[0], nsuggestions, word);
+
+	if (corrections == NULL) {
+		soundexes = get_soundex_list(spell, word);
+		if (soundexes != NULL) {
+			corrections = spell_get_corrections(spell, soundexes, nsuggestions, word);
+		}
 	}
 
+	if (corrections == NULL) {
+		clear_candidates(&ctx->edits[1]);
+		symspell_candidates(matches, nmatches, word, 2, spell->symspell->maxdist,
+		    &ctx->edits[1]);
+		corrections = get_buffered_corrections(spell, &ctx->edits[1], nsuggestions, word);
+	}
+	free(matches);
+
 	if (corrections == NULL) {
 		soundexes = get_soundex2_list(spell, word);
 		if (soundexes) {
 			corrections = spell_get_corrections(spell, soundexes, nsuggestions, word);
-			free_word_list(soundexes);
 		}
 	}
 	return corrections;
 }
 
+word_list *
+spell_get_suggestions_symspell(spell_t *spell, char *word, size_t nsuggestions)
+{
+	return cached_suggestions(spell, get_suggestions_symspell, QUERY_SYMSPELL, word,
+	    nsuggestions);
+}
+
 
 int
 compare_words(void *context, const void *node1, const void *node2)
@@ -1159,6 +3174,26 @@ spell_destroy(spell_t * spell)
 {
 	word_list *list;
 	trie_destroy(spell->dictionary);
+	dawg_destroy(spell->dawg);
+	art_destroy(spell->art);
+	louds_destroy(spell->louds);
+	symspell_destroy(spell->symspell);
+	workpool_destroy(spell->pool);
+	cache_destroy(spell->cache);
+	bloom_destroy(spell->filter);
+	free_hot(spell->hot);
+	free(spell->alphabet);
+	free(spell->code_alphabet);
+
+	if (spell->rcu != NULL) {
+		pthread_mutex_destroy(&spell->rcu->writer);
+		free(spell->rcu);
+	}
+
+	if (spell->image != NULL) {
+		munmap(spell->image->base, spell->image->size);
+		free(spell->image);
+	}
 
 	if (spell->ngrams_tree != NULL)
 		free_tree(spell->ngrams_tree);
@@ -1226,28 +3261,6 @@ is_vowel(char c)
 	return 0;
 }
 
-static char *
-to_upper(const char *s)
-{
-	char *u = strdup(s);
-	size_t i = 0;
-	while(u[i] != 0) {
-		u[i] = toupper((int) u[i]);
-		i++;
-	}
-	return u;
-}
-
-static char *
-pad(const char *s)
-{
-	char *ret = NULL;
-	asprintf(&ret, "--%s------", s);
-	if (ret == NULL)
-		err(EXIT_FAILURE, "malloc failed");
-	return ret;
-}
-
 static int
 is_slavo_germanic(const char *s)
 {
@@ -1278,23 +3291,33 @@ is_in(const char *s, size_t len, size_t count, ...)
 	return 0;
 }
 
-char *
-double_metaphone(const char *s)
+/*
+ * metaphone_code--
+ *  Computes the double metaphone code of s into pri, which needs room for
+ *  METAPHONE_CODE_SIZE(strlen(s)) bytes, and never more than
+ *  METAPHONE_CODE_MAX. Only the first METAPHONE_MAX_WORD characters of s
+ *  are coded. Everything else lives on the stack, in buffers of a fixed
+ *  size, so that the code of every generated candidate can be checked
+ *  without going through malloc(3).
+ */
+static char *
+metaphone_code(const char *s, char *pri)
 {
-	char *st = to_upper(s);
 	int is_sl_germanic = is_slavo_germanic(s);
-	size_t len = strlen(st);
+	size_t len = strnlen(s, METAPHONE_MAX_WORD);
 	size_t first = 2;
 	size_t last = first + len - 1;
 	size_t pos = first;
-	char *pri = malloc(len + 10);
-	char *sec = malloc(len + 10);
+	char st[METAPHONE_MAX_WORD + 9];
 	size_t pri_offset = 0;
-	size_t sec_offset = 0;
+	size_t i;
 	struct next nxt;
-	char *padded = pad(st);
-	free(st);
-	st = padded;
+
+	/* Pad the upper cased word so that the rules can look around freely */
+	memcpy(st, "--", 2);
+	for (i = 0; i < len; i++)
+		st[first + i] = toupper((int) s[i]);
+	memcpy(st + first + len, "------", 7);
 
 	if ((st[first] == 'G' && st[first + 1] == 'N') ||
 	    (st[first] == 'K' && st[first + 1] == 'N') ||
@@ -1928,109 +3951,405 @@ double_metaphone(const char *s)
 			else
 				nxt.offset = 1;
 		}
-		if (nxt.sec[0] == 0) {
-			if (nxt.pri[0]) {
-				pri[pri_offset++] = nxt.pri[0];
-				if (nxt.pri[1])
-					pri[pri_offset++] = nxt.pri[1];
-				sec[sec_offset++] = nxt.pri[0];
-				if (nxt.pri[1])
-					sec[sec_offset++] = nxt.pri[1];
-
-			}
-			pos += nxt.offset;
-		} else {
-			if (nxt.pri[0]) {
-				pri[pri_offset++] = nxt.pri[0];
-				if (nxt.pri[1])
-					pri[pri_offset++] = nxt.pri[1];
-			}
-			if (nxt.sec[0])
-				sec[sec_offset++] = nxt.sec[0];
-			if (nxt.sec[1])
-				sec[sec_offset++] = nxt.sec[1];
-			pos += nxt.offset;
+		/* Only the primary code is kept, the rules' secondary one is dropped */
+		if (nxt.pri[0]) {
+			pri[pri_offset++] = nxt.pri[0];
+			if (nxt.pri[1])
+				pri[pri_offset++] = nxt.pri[1];
 		}
+		pos += nxt.offset;
 	}
-    free(st);
 	pri[pri_offset] = 0;
-	sec[sec_offset] = 0;
-    free(sec);
 	return pri;
 }
 
+char *
+double_metaphone(const char *s)
+{
+	char *code = malloc(METAPHONE_CODE_SIZE(strlen(s)));
+
+	if (code == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	return metaphone_code(s, code);
+}
+
+static char **
+dictionary_completions(spell_t *spell, const char *word)
+{
+	switch (spell->backend) {
+	case SPELL_BACKEND_DAWG:
+		return dawg_prefix_matches(spell->dawg, word);
+	case SPELL_BACKEND_ART:
+		return art_prefix_matches(spell->art, word);
+	case SPELL_BACKEND_LOUDS:
+		return louds_prefix_matches(spell->louds, word);
+	default:
+		return get_prefix_matches(spell->dictionary, word);
+	}
+}
+
 char **
 get_completions(spell_t *spell, const char *word)
 {
-	return get_prefix_matches(spell->dictionary, word);
+	spell_t view;
+	unsigned int idx = spell_read_lock(spell, &view);
+	char **completions = dictionary_completions(&view, word);
+
+	spell_read_unlock(spell, idx);
+	return completions;
 }
 
+typedef struct ranked_completion {
+	char *word;
+	size_t count;
+} ranked_completion;
 
-word_list *
-metaphone_spell_check(spell_t *spell, char *word)
+static int
+compare_completions(const void *v1, const void *v2)
 {
-	char *metaphone = double_metaphone(word);
-	word_list node;
-	node.word = metaphone;
+	const ranked_completion *c1 = v1;
+	const ranked_completion *c2 = v2;
+	if (c1->count != c2->count)
+		return c1->count < c2->count ? 1 : -1;
+	return strcmp(c1->word, c2->word);
+}
+
+/*
+ * Ranks every completion by its count; used for the backends which cannot
+ * search their words in frequency order. Like trie_top_completions, it
+ * returns NULL rather than an empty list when k is 0 or nothing matched.
+ */
+static char **
+rank_completions(spell_t *spell, char **completions, size_t k)
+{
+	ranked_completion *ranked;
+	size_t i, n;
+
+	for (n = 0; completions[n] != NULL; n++)
+		;
+	if (n == 0 || k == 0) {
+		for (i = 0; i < n; i++)
+			free(completions[i]);
+		free(completions);
+		return NULL;
+	}
+	ranked = malloc(n * sizeof(*ranked));
+	if (ranked == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	for (i = 0; i < n; i++) {
+		ranked[i].word = completions[i];
+		ranked[i].count = dictionary_get(spell, completions[i]);
+	}
+	qsort(ranked, n, sizeof(*ranked), compare_completions);
+	for (i = 0; i < n; i++) {
+		if (i < k)
+			completions[i] = ranked[i].word;
+		else
+			free(ranked[i].word);
+	}
+	completions[n < k ? n : k] = NULL;
+	free(ranked);
+	return completions;
+}
+
+static char **
+dictionary_top_completions(spell_t *spell, const char *word, size_t k)
+{
+	trie_match *matches;
+	char **completions;
+	char **list;
+	size_t i, n;
+
+	switch (spell->backend) {
+	case SPELL_BACKEND_DAWG:
+		completions = dawg_prefix_matches(spell->dawg, word);
+		if (completions == NULL)
+			return NULL;
+		return rank_completions(spell, completions, k);
+	case SPELL_BACKEND_ART:
+		completions = art_prefix_matches(spell->art, word);
+		if (completions == NULL)
+			return NULL;
+		return rank_completions(spell, completions, k);
+	case SPELL_BACKEND_LOUDS:
+		completions = louds_prefix_matches(spell->louds, word);
+		if (completions == NULL)
+			return NULL;
+		return rank_completions(spell, completions, k);
+	default:
+		matches = trie_top_completions(spell->dictionary, word, k, &n);
+		if (matches == NULL)
+			return NULL;
+		list = malloc((n + 1) * sizeof(*list));
+		if (list == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+		for (i = 0; i < n; i++) {
+			list[i] = matches[i].word;
+			matches[i].word = NULL;
+		}
+		list[n] = NULL;
+		free_trie_matches(matches, n);
+		return list;
+	}
+}
+
+/*
+ * get_top_completions--
+ *  Returns a NULL terminated list of at most k words starting with word,
+ *  the most frequent one first, or NULL if there are none or k is 0.
+ */
+char **
+get_top_completions(spell_t *spell, const char *word, size_t k)
+{
+	spell_t view;
+	unsigned int idx = spell_read_lock(spell, &view);
+	char **completions = dictionary_top_completions(&view, word, k);
+
+	spell_read_unlock(spell, idx);
+	return completions;
+}
+
+static int
+compare_counts(const void *a, const void *b)
+{
+	const word_count *wc1 = a;
+	const word_count *wc2 = b;
+
+	return wc1->count < wc2->count ? 1 : wc1->count > wc2->count ? -1 : 0;
+}
+
+/*
+ * Returns every word of the dictionary with its count, the words malloc'd
+ * one by one. The backends do not list all their words at once, only
+ * those starting with a given prefix, but each of those lists is
+ * complete, whatever the length of the words: the filter built from them
+ * must never turn down a dictionary word.
+ */
+static word_count *
+collect_words(spell_t *spell, size_t *nwords)
+{
+	word_count *words = NULL, *newwords;
+	size_t size = 0, i;
+	char prefix[2];
+	char **list;
+	int c;
+
+	*nwords = 0;
+	prefix[1] = 0;
+	for (c = 1; c <= UCHAR_MAX; c++) {
+		prefix[0] = c;
+		if ((list = dictionary_completions(spell, prefix)) == NULL)
+			continue;
+		for (i = 0; list[i] != NULL; i++) {
+			if (*nwords == size) {
+				size = size == 0 ? 1024 : size * 2;
+				newwords = realloc(words, size * sizeof(*words));
+				if (newwords == NULL)
+					err(EXIT_FAILURE, "malloc failed");
+				words = newwords;
+			}
+			words[*nwords].word = list[i];
+			words[(*nwords)++].count = dictionary_get(spell, list[i]);
+		}
+		free(list);
+	}
+	return words;
+}
+
+/*
+ * Derives the alphabets edits1 works with from the words of the
+ * dictionary and the codes of the phonetic index. A trie gives up its
+ * character pairs from its nodes directly; the other backends list all
+ * their words.
+ */
+static void
+build_alphabets(spell_t *spell)
+{
+	word_count *words;
+	word_list *bucket;
+	size_t nwords, i;
+
+	spell->alphabet = alphabet_init();
+	if (spell->backend == SPELL_BACKEND_TRIE) {
+		alphabet_add_trie(spell->alphabet, spell->dictionary);
+	} else {
+		words = collect_words(spell, &nwords);
+		for (i = 0; i < nwords; i++) {
+			alphabet_add(spell->alphabet, words[i].word);
+			free(words[i].word);
+		}
+		free(words);
+	}
+
+	spell->code_alphabet = alphabet_init();
+	if (spell->image != NULL) {
+		for (i = 0; i < spell->image->ncodes; i++)
+			alphabet_add(spell->code_alphabet,
+			    spell->image->strings + spell->image->codes[i].code);
+	} else if (spell->soundex_tree != NULL) {
+		RB_TREE_FOREACH(bucket, spell->soundex_tree)
+			alphabet_add(spell->code_alphabet, bucket->word);
+	}
+}
+
+/*
+ * Builds the exact hot set of the first nwords words, hashed with the
+ * unigram seed.
+ */
+static struct spell_hot *
+build_hot(const word_count *words, size_t nwords)
+{
+	struct spell_hot *hot;
+	size_t i, j, len, size = 0;
+	uint32_t hashes[3];
+
+	if ((hot = malloc(sizeof(*hot))) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	hot->nslots = 1;
+	while (hot->nslots < 2 * nwords)
+		hot->nslots *= 2;
+	for (i = 0; i < nwords; i++)
+		size += strlen(words[i].word) + 1;
+	hot->slots = calloc(hot->nslots, sizeof(*hot->slots));
+	hot->words = malloc(size);
+	if (hot->slots == NULL || hot->words == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+
+	size = 0;
+	for (i = 0; i < nwords; i++) {
+		len = strlen(words[i].word);
+		bloom_hash(words[i].word, len, UNIGRAM_SEED, hashes);
+		for (j = hashes[2] & (hot->nslots - 1); hot->slots[j].word != 0;
+		    j = (j + 1) & (hot->nslots - 1))
+			continue;
+		hot->slots[j].hash = hashes[2];
+		hot->slots[j].word = size + 1;
+		memcpy(hot->words + size, words[i].word, len + 1);
+		size += len + 1;
+	}
+	return hot;
+}
+
+/*
+ * Returns a new hot set of the most frequent of the words of hot and of
+ * the n words just added to dictionary, with their counts in it.
+ */
+static struct spell_hot *
+update_hot(const struct spell_hot *hot, trie_t *dictionary, char **words,
+    size_t n)
+{
+	struct spell_hot *newhot;
+	word_count *wc;
+	size_t i, nwc = 0;
+	uint32_t hashes[3];
+
+	if ((wc = malloc((hot->nslots + n) * sizeof(*wc))) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	for (i = 0; i < hot->nslots; i++) {
+		if (hot->slots[i].word == 0)
+			continue;
+		wc[nwc].word = hot->words + hot->slots[i].word - 1;
+		wc[nwc].count = trie_get(dictionary, wc[nwc].word);
+		nwc++;
+	}
+	for (i = 0; i < n; i++) {
+		bloom_hash(words[i], strlen(words[i]), UNIGRAM_SEED, hashes);
+		if (hot_find(hot, words[i], hashes))
+			continue;
+		wc[nwc].word = words[i];
+		wc[nwc].count = trie_get(dictionary, words[i]);
+		nwc++;
+	}
+	qsort(wc, nwc, sizeof(*wc), compare_counts);
+	newhot = build_hot(wc, nwc < HOT_WORDS ? nwc : HOT_WORDS);
+	free(wc);
+	return newhot;
+}
+
+/*
+ * spell_load_filter--
+ *  Builds a Bloom filter of the unigrams and bigrams of spell, and an
+ *  exact hash set of its most frequent words, which spell_is_known_word
+ *  looks at before the dictionary. Bigrams loaded later and words added
+ *  with spell_add_words go into the filter too, and the words into the
+ *  hot set if they are frequent enough. Call it before spell is
+ *  shared between threads.
+ */
+int
+spell_load_filter(spell_t *spell)
+{
+	word_count *words;
+	size_t nwords, nbigrams = 0, i;
+	word_count *wc;
+	uint32_t hashes[3];
+
+	words = collect_words(spell, &nwords);
+	if (spell->ngrams_tree != NULL)
+		RB_TREE_FOREACH(wc, spell->ngrams_tree)
+			nbigrams++;
+
+	bloom_destroy(spell->filter);
+	free_hot(spell->hot);
+	spell->filter = bloom_init(nwords + nbigrams);
+	for (i = 0; i < nwords; i++) {
+		bloom_hash(words[i].word, strlen(words[i].word), UNIGRAM_SEED, hashes);
+		bloom_add(spell->filter, hashes);
+	}
+	if (spell->ngrams_tree != NULL)
+		filter_add_bigrams(spell);
+
+	qsort(words, nwords, sizeof(*words), compare_counts);
+	spell->hot = build_hot(words, nwords < HOT_WORDS ? nwords : HOT_WORDS);
+
+	for (i = 0; i < nwords; i++)
+		free(words[i].word);
+	free(words);
+	return 0;
+}
+
+
+static word_list *
+metaphone_check(spell_t *spell, char *word)
+{
+	char metaphone[METAPHONE_CODE_MAX];
 	word_list *matches = NULL;
-	word_list *words = rb_tree_find_node(spell->soundex_tree, &node);
+	word_list *words;
 	size_t min_distance = 10000;
 	char **corrections = NULL;
 	word_list *ret = NULL;
-	if (words != NULL) {
+
+	metaphone_code(word, metaphone);
+	words = get_phonetic_bucket(spell, metaphone);
+	if (words != NULL)
 		ret = spell_get_corrections(spell, words, 1, word);
-	}
 
-	word_list *distance_one_mphones = edits1(metaphone, 1);
-	if (distance_one_mphones == NULL) {
+	spell_query_ctx *ctx = get_query_ctx();
+	candidate_buf *distance_one_mphones = &ctx->codes[0];
+	candidate_buf *distance_two_mphones = &ctx->codes[1];
+	clear_candidates(distance_one_mphones);
+	edits1(spell, metaphone, 1, &phonetic_steps, distance_one_mphones);
+	if (distance_one_mphones->n == 0) {
 		fprintf(stderr, "distaonce_one_mphones null for %s\n", word);
-		free(metaphone);
 		return NULL;
 	}
 
-	word_list *tempnode = distance_one_mphones;
-	while (tempnode && tempnode->next != NULL) {
-		node.word = tempnode->word;
-		words = rb_tree_find_node(spell->soundex_tree, &node);
-		if (words != NULL) {
-			if (matches == NULL)
-				matches = copy_word_list(words->next);
-			else
-				append_word_list(matches, copy_word_list(words->next));
-		}
-		tempnode = tempnode->next;
-	}
+	matches = get_phonetic_buckets(spell, distance_one_mphones, matches);
 
 	if (matches != NULL) {
 		word_list *ret2 = spell_get_corrections(spell, matches, 1, word);
 		append_word_list(ret, ret2);
 	//	free_word_list(matches);
 	//	free_word_list(distance_one_mphones);
-	//	free(metaphone);
 	}
 
-	word_list *distance_two_mphones = edits_plus_one(distance_one_mphones);
-	tempnode = distance_two_mphones;
-	while (tempnode->next != NULL) {
-		node.word = tempnode->word;
-		words = rb_tree_find_node(spell->soundex_tree, &node);
-		if (words != NULL) {
-			if (matches == NULL)
-				matches = copy_word_list(words->next);
-			else
-				append_word_list(matches, copy_word_list(words->next));
-		}
-		tempnode = tempnode->next;
-	}
+	clear_candidates(distance_two_mphones);
+	edits_plus_one(spell, distance_one_mphones, &phonetic_codes, distance_two_mphones);
+	matches = get_phonetic_buckets(spell, distance_two_mphones, matches);
 
 	if (matches != NULL) {
 		word_list *ret2 = spell_get_corrections(spell, matches, 1, word);
 		append_word_list(ret, ret2);
 	}
-	free_word_list(matches);
-	free_word_list(distance_one_mphones);
-	free_word_list(distance_two_mphones);
-	free(metaphone);
 
 MIN_DISTANCE:
 	corrections = malloc(sizeof(*corrections) * 2);
@@ -2048,3 +4367,23 @@ MIN_DISTANCE:
 	return corrections;*/
 	return ret;
 }
+
+word_list *
+metaphone_spell_check(spell_t *spell, char *word)
+{
+	spell_t view;
+	unsigned int idx;
+	spell_query_ctx *ctx = get_query_ctx();
+	word_list *corrections;
+	char *packed;
+	size_t len;
+
+	if (strlen(word) > TRIE_MAX_WORD)
+		return NULL;
+	idx = spell_read_lock(spell, &view);
+	packed = pack_word_list(ctx, metaphone_check(&view, word), &len);
+	corrections = unpack_word_list(packed, len);
+	query_reset(ctx);
+	spell_read_unlock(spell, idx);
+	return corrections;
+}
@@ -31,7 +31,14 @@
 #define LIBSPELL_H
 
 #include <sys/rbtree.h>
+#include "art.h"
+#include "bloom.h"
+#include "cache.h"
+#include "dawg.h"
+#include "louds.h"
+#include "symspell.h"
 #include "trie.h"
+#include "workpool.h"
 
 /* Number of possible arrangements of a word of length ``n'' at edit distance 1 */
 #define COMBINATIONS(n) n + n - 1 + 26 * n + 26 * (n + 1)
@@ -56,19 +63,54 @@ typedef struct word_list {
 } word_list;
 
 
+/* Data structures which can hold the unigram dictionary */
+#define SPELL_BACKEND_TRIE	0
+#define SPELL_BACKEND_DAWG	1
+#define SPELL_BACKEND_ART	2
+#define SPELL_BACKEND_LOUDS	3
+
+struct spell_alphabet;
+struct spell_hot;
+struct spell_image;
+struct spell_rcu;
+
 typedef struct spell_t {
+	int backend;
 	trie_t *dictionary;
+	dawg_t *dawg;
+	art_t *art;
+	louds_t *louds;
+	symspell_t *symspell;
+	workpool_t *pool;
+	cache_t *cache;
+	bloom_t *filter;
+	struct spell_hot *hot;
+	struct spell_alphabet *alphabet;
+	struct spell_alphabet *code_alphabet;
 	rb_tree_t *ngrams_tree;
 	rb_tree_t *soundex_tree;
+	struct spell_image *image;
+	struct spell_rcu *rcu;
 } spell_t;
 
 
 void free_list(char **);
 spell_t *spell_init(const char *, const char *);
+spell_t *spell_init_backend(const char *, const char *, int);
 spell_t *spell_init2(word_list *, word_list *);
+spell_t *spell_open_image(const char *);
+int spell_write_image(spell_t *, const char *);
+int spell_add_words(spell_t *, char **, const size_t *, size_t);
 int spell_is_known_word(spell_t *, const char *, int);
 word_list *spell_get_suggestions_slow(spell_t *, char *, size_t);
 word_list *spell_get_suggestions_fast(spell_t *, char *, size_t);
+int spell_load_symspell(spell_t *, const char *, const char *, unsigned int,
+    unsigned int);
+word_list *spell_get_suggestions_symspell(spell_t *, char *, size_t);
+int spell_set_threads(spell_t *, size_t);
+int spell_set_cache(spell_t *, size_t);
+void spell_get_cache_stats(spell_t *, cache_stats *);
+int spell_load_filter(spell_t *);
 char *soundex(const char *);
 char *double_metaphone(const char *);
 void spell_destroy(spell_t *);
@@ -81,5 +123,6 @@ void free_word_list(word_list *);
 word_list *metaphone_spell_check(spell_t *, char *);
 int load_bigrams(spell_t *, const char *);
 char **get_completions(spell_t *, const char *);
+char **get_top_completions(spell_t *, const char *, size_t);
 
 #endif
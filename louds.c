@@ -0,0 +1,458 @@
+/*-
+ * Copyright (c) 2017 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "louds.h"
+
+#define LOUDS_SAMPLE	64	/* zeros between select0 samples */
+#define LOUDS_BLOCK	256	/* terminal bits between rank samples */
+
+/* A growing bit string used while building */
+typedef struct louds_bitvec {
+	uint64_t *v;
+	size_t n;
+	size_t size;
+} louds_bitvec;
+
+/* The words of the input below one node: keys [lo, hi) share depth bytes */
+typedef struct louds_range {
+	uint32_t lo;
+	uint32_t hi;
+	uint32_t depth;
+} louds_range;
+
+static void *
+xrealloc(void *p, size_t nmemb, size_t size)
+{
+	if (nmemb != 0 && SIZE_MAX / nmemb < size)
+		errx(EXIT_FAILURE, "louds: too large");
+	if ((p = realloc(p, nmemb * size)) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	return p;
+}
+
+static void
+bitvec_push(louds_bitvec *b, int bit)
+{
+	if (b->n == b->size * 64) {
+		b->v = xrealloc(b->v, b->size * 2, sizeof(*b->v));
+		memset(b->v + b->size, 0, b->size * sizeof(*b->v));
+		b->size *= 2;
+	}
+	if (bit)
+		b->v[b->n >> 6] |= 1ULL << (b->n & 63);
+	b->n++;
+}
+
+/* Returns the bits, with a zero word past the end for the scans to read */
+static uint64_t *
+bitvec_finish(louds_bitvec *b)
+{
+	size_t nwords = b->n / 64 + 2;
+
+	if (nwords > b->size) {
+		b->v = xrealloc(b->v, nwords, sizeof(*b->v));
+		memset(b->v + b->size, 0, (nwords - b->size) * sizeof(*b->v));
+	}
+	return b->v;
+}
+
+static void
+bitvec_init(louds_bitvec *b)
+{
+	b->n = 0;
+	b->size = 16;
+	if ((b->v = calloc(b->size, sizeof(*b->v))) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+}
+
+static int
+get_bit(const uint64_t *v, size_t i)
+{
+	return (v[i >> 6] >> (i & 63)) & 1;
+}
+
+/* Position of the i-th zero bit of the tree shape, counting from 0 */
+static uint32_t
+select0(const louds_t *l, uint32_t i)
+{
+	uint32_t pos = l->select0[i / LOUDS_SAMPLE];
+	uint32_t rest = i % LOUDS_SAMPLE;
+	size_t w = pos >> 6;
+	uint64_t word = ~l->bits[w] & (~0ULL << (pos & 63));
+	unsigned int n;
+
+	while ((n = __builtin_popcountll(word)) <= rest) {
+		rest -= n;
+		word = ~l->bits[++w];
+	}
+	for (; rest > 0; rest--)
+		word &= word - 1;
+	return (w << 6) + __builtin_ctzll(word);
+}
+
+/* Position of the first zero bit at or after pos */
+static uint32_t
+next_zero(const louds_t *l, uint32_t pos)
+{
+	size_t w = pos >> 6;
+	uint64_t word = ~l->bits[w] & (~0ULL << (pos & 63));
+
+	while (word == 0)
+		word = ~l->bits[++w];
+	return (w << 6) + __builtin_ctzll(word);
+}
+
+/* Number of words ending at the nodes before v */
+static uint32_t
+terminal_rank(const louds_t *l, uint32_t v)
+{
+	uint32_t rank = l->terminal_rank[v / LOUDS_BLOCK];
+	size_t w;
+
+	for (w = (v / LOUDS_BLOCK) * (LOUDS_BLOCK / 64); w < v >> 6; w++)
+		rank += __builtin_popcountll(l->terminal[w]);
+	if (v & 63)
+		rank += __builtin_popcountll(l->terminal[w] & ((1ULL << (v & 63)) - 1));
+	return rank;
+}
+
+static uint32_t
+get_count(const louds_t *l, uint32_t i)
+{
+	size_t pos = (size_t) i * l->count_width;
+	size_t w = pos >> 6;
+	unsigned int off = pos & 63;
+	uint64_t v = l->counts[w] >> off;
+
+	if (off + l->count_width > 64)
+		v |= l->counts[w + 1] << (64 - off);
+	return v & ((1ULL << l->count_width) - 1);
+}
+
+/*
+ * Finds the child of v labelled c and stores it in *child. The children
+ * of a node are consecutive and sorted by label.
+ */
+static int
+louds_child(const louds_t *l, uint32_t v, unsigned char c, uint32_t *child)
+{
+	uint32_t start = select0(l, v);
+	uint32_t first = start - v;
+	uint32_t n = next_zero(l, start + 1) - start - 1;
+	const unsigned char *p;
+
+	if (n == 0 || (p = memchr(l->labels + first, c, n)) == NULL)
+		return 0;
+	*child = p - l->labels;
+	return 1;
+}
+
+/*
+ * louds_build--
+ *  Builds the trie out of n keys, which must be sorted and unique, and
+ *  their values. Empty keys are ignored. Returns NULL if the input is not
+ *  sorted.
+ */
+louds_t *
+louds_build(char **keys, const size_t *values, size_t n)
+{
+	louds_t *l;
+	louds_bitvec bits, terminal;
+	louds_range *queue, r;
+	size_t *lens, *word_values;
+	size_t nqueue = 0, queue_size = 1024, i, j, v, nzeros;
+	uint64_t maxcount = 1, count;
+	unsigned char c;
+
+	if (n >= UINT32_MAX)
+		return NULL;
+
+	lens = xrealloc(NULL, n ? n : 1, sizeof(*lens));
+	for (i = 0; i < n; i++) {
+		lens[i] = strlen(keys[i]);
+		if (i > 0 && strcmp(keys[i - 1], keys[i]) >= 0) {
+			warnx("louds: keys are not sorted or not unique at %s",
+			    keys[i]);
+			free(lens);
+			return NULL;
+		}
+	}
+
+	l = calloc(1, sizeof(*l));
+	if (l == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	bitvec_init(&bits);
+	bitvec_init(&terminal);
+	queue = xrealloc(NULL, queue_size, sizeof(*queue));
+	word_values = xrealloc(NULL, n ? n : 1, sizeof(*word_values));
+
+	/* The super root: one child and its terminating zero */
+	bitvec_push(&bits, 1);
+	bitvec_push(&bits, 0);
+	queue[0].lo = 0;
+	queue[0].hi = n;
+	queue[0].depth = 0;
+	nqueue = 1;
+
+	/*
+	 * Breadth first over the sorted keys: each queued range is a node and
+	 * its children are the runs of keys sharing the next byte. A key
+	 * which ends at the node sorts first in its range.
+	 */
+	for (v = 0; v < nqueue; v++) {
+		r = queue[v];
+		i = r.lo;
+		if (i < r.hi && lens[i] == r.depth) {
+			if (r.depth != 0)
+				word_values[l->nwords++] = values[i];
+			bitvec_push(&terminal, r.depth != 0);
+			i++;
+		} else
+			bitvec_push(&terminal, 0);
+
+		for (; i < r.hi; i = j) {
+			c = keys[i][r.depth];
+			for (j = i + 1; j < r.hi &&
+			    (unsigned char) keys[j][r.depth] == c; j++)
+				;
+			if (nqueue == queue_size) {
+				queue_size *= 2;
+				queue = xrealloc(queue, queue_size, sizeof(*queue));
+			}
+			queue[nqueue].lo = i;
+			queue[nqueue].hi = j;
+			queue[nqueue].depth = r.depth + 1;
+			nqueue++;
+			bitvec_push(&bits, 1);
+		}
+		bitvec_push(&bits, 0);
+	}
+	free(lens);
+
+	/* The labels are the first bytes of the ranges one level down */
+	l->nnodes = nqueue;
+	l->labels = xrealloc(NULL, nqueue, 1);
+	l->labels[0] = 0;
+	for (v = 1; v < nqueue; v++)
+		l->labels[v] = keys[queue[v].lo][queue[v].depth - 1];
+	free(queue);
+
+	l->bits = bitvec_finish(&bits);
+	l->terminal = bitvec_finish(&terminal);
+
+	l->select0 = xrealloc(NULL, (nqueue + 1) / LOUDS_SAMPLE + 1,
+	    sizeof(*l->select0));
+	for (i = 0, nzeros = 0; i < bits.n; i++) {
+		if (get_bit(l->bits, i))
+			continue;
+		if (nzeros % LOUDS_SAMPLE == 0)
+			l->select0[nzeros / LOUDS_SAMPLE] = i;
+		nzeros++;
+	}
+
+	l->terminal_rank = xrealloc(NULL, nqueue / LOUDS_BLOCK + 1,
+	    sizeof(*l->terminal_rank));
+	for (v = 0, count = 0; v < nqueue; v++) {
+		if (v % LOUDS_BLOCK == 0)
+			l->terminal_rank[v / LOUDS_BLOCK] = count;
+		count += get_bit(l->terminal, v);
+	}
+
+	for (i = 0; i < l->nwords; i++) {
+		if (word_values[i] > UINT32_MAX)
+			word_values[i] = UINT32_MAX;
+		if (word_values[i] > maxcount)
+			maxcount = word_values[i];
+	}
+	l->count_width = 64 - __builtin_clzll(maxcount);
+	l->counts = calloc(((size_t) l->nwords * l->count_width) / 64 + 2,
+	    sizeof(*l->counts));
+	if (l->counts == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	for (i = 0; i < l->nwords; i++) {
+		count = (size_t) i * l->count_width;
+		l->counts[count >> 6] |= (uint64_t) word_values[i] << (count & 63);
+		if ((count & 63) + l->count_width > 64)
+			l->counts[(count >> 6) + 1] |=
+			    (uint64_t) word_values[i] >> (64 - (count & 63));
+	}
+	free(word_values);
+	return l;
+}
+
+/*
+ * Walks down to the node spelling key, returning 0 if there is none.
+ */
+static int
+louds_find(const louds_t *l, const char *key, uint32_t *node)
+{
+	const unsigned char *k = (const unsigned char *) key;
+	uint32_t v = 0;
+
+	for (; *k; k++)
+		if (!louds_child(l, v, *k, &v))
+			return 0;
+	*node = v;
+	return 1;
+}
+
+size_t
+louds_get(const louds_t *l, const char *key)
+{
+	uint32_t v;
+
+	if (l == NULL || *key == 0 || !louds_find(l, key, &v))
+		return 0;
+	if (!get_bit(l->terminal, v))
+		return 0;
+	return get_count(l, terminal_rank(l, v));
+}
+
+/*
+ * louds_prefix_len--
+ *  Returns the length of the longest prefix of key that some word of the
+ *  trie starts with, i.e. how far key can be followed from the root.
+ */
+size_t
+louds_prefix_len(const louds_t *l, const char *key)
+{
+	const unsigned char *k = (const unsigned char *) key;
+	uint32_t v = 0;
+	size_t len = 0;
+
+	if (l == NULL)
+		return 0;
+
+	while (k[len] != 0 && louds_child(l, v, k[len], &v))
+		len++;
+	return len;
+}
+
+typedef struct louds_words {
+	char **list;
+	size_t n;
+	size_t size;
+	char *buf;
+	size_t bufsize;
+} louds_words;
+
+static void
+louds_collect(const louds_t *l, uint32_t v, size_t len, louds_words *w)
+{
+	uint32_t start, first, end, u;
+
+	if (len + 2 > w->bufsize) {
+		w->bufsize = (len + 2) * 2;
+		w->buf = xrealloc(w->buf, w->bufsize, 1);
+	}
+	if (get_bit(l->terminal, v)) {
+		if (w->n + 1 == w->size) {
+			w->size *= 2;
+			w->list = xrealloc(w->list, w->size, sizeof(*w->list));
+		}
+		w->buf[len] = 0;
+		if ((w->list[w->n++] = strdup(w->buf)) == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+	}
+
+	start = select0(l, v);
+	first = start - v;
+	end = first + next_zero(l, start + 1) - start - 1;
+	for (u = first; u < end; u++) {
+		w->buf[len] = l->labels[u];
+		louds_collect(l, u, len + 1, w);
+	}
+}
+
+/*
+ * Returns the NULL terminated list of words starting with prefix, in
+ * sorted order, or NULL if there are none.
+ */
+char **
+louds_prefix_matches(const louds_t *l, const char *prefix)
+{
+	louds_words w;
+	uint32_t v;
+	size_t len;
+
+	if (l == NULL || prefix == NULL || *prefix == 0)
+		return NULL;
+	if (!louds_find(l, prefix, &v))
+		return NULL;
+
+	len = strlen(prefix);
+	w.n = 0;
+	w.size = 16;
+	w.list = xrealloc(NULL, w.size, sizeof(*w.list));
+	w.bufsize = len + 16;
+	w.buf = xrealloc(NULL, w.bufsize, 1);
+	memcpy(w.buf, prefix, len);
+	louds_collect(l, v, len, &w);
+	free(w.buf);
+	if (w.n == 0) {
+		free(w.list);
+		return NULL;
+	}
+	w.list[w.n] = NULL;
+	return w.list;
+}
+
+/* Bytes used by the trie, for comparing it with the other backends */
+size_t
+louds_memory(const louds_t *l)
+{
+	size_t nbits = 2 * (size_t) l->nnodes + 1;
+
+	return sizeof(*l) +
+	    (nbits / 64 + 2) * sizeof(*l->bits) +
+	    ((l->nnodes + 1) / LOUDS_SAMPLE + 1) * sizeof(*l->select0) +
+	    l->nnodes +
+	    (l->nnodes / 64 + 2) * sizeof(*l->terminal) +
+	    (l->nnodes / LOUDS_BLOCK + 1) * sizeof(*l->terminal_rank) +
+	    (((size_t) l->nwords * l->count_width) / 64 + 2) * sizeof(*l->counts);
+}
+
+void
+louds_destroy(louds_t *l)
+{
+	if (l == NULL)
+		return;
+	free(l->bits);
+	free(l->select0);
+	free(l->labels);
+	free(l->terminal);
+	free(l->terminal_rank);
+	free(l->counts);
+	free(l);
+}
@@ -0,0 +1,64 @@
+/*-
+ * Copyright (c) 2017 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LOUDS_H
+#define LOUDS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A read-only trie in LOUDS form (level-order unary degree sequence).
+ * Nodes are numbered in breadth first order and the shape of the tree is
+ * one bit string holding 1^d 0 for every node of degree d, behind a "10"
+ * for a virtual super root. The children of node v are then the nodes
+ * select0(v) - v onwards, so a lookup needs nothing but the bit string,
+ * one label byte per node, a bit per node marking the ends of words and
+ * the counts of the words, packed in as few bits as the largest needs.
+ */
+typedef struct louds_t {
+	uint64_t *bits;
+	uint32_t *select0;	/* position of every LOUDS_SAMPLE-th zero bit */
+	unsigned char *labels;
+	uint64_t *terminal;
+	uint32_t *terminal_rank;	/* terminal bits set before every block */
+	uint64_t *counts;
+	uint32_t nnodes;
+	uint32_t nwords;
+	unsigned int count_width;
+} louds_t;
+
+louds_t *louds_build(char **, const size_t *, size_t);
+size_t louds_get(const louds_t *, const char *);
+size_t louds_prefix_len(const louds_t *, const char *);
+char **louds_prefix_matches(const louds_t *, const char *);
+size_t louds_memory(const louds_t *);
+void louds_destroy(louds_t *);
+
+#endif
@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "louds.h"
+#include "test_util.h"
+#include "trie.h"
+
+/*
+ * Every third word also comes with an "ing" ending. The last count needs
+ * more than 32 bits, which widens the packed counts of every word.
+ */
+static size_t
+make_words(char words[][20], char **sorted, size_t *counts)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < NWORDS; i++) {
+		make_word(i, words[n]);
+		sorted[n] = words[n];
+		n++;
+		if (i % 3 == 0) {
+			make_word(i, words[n]);
+			strcat(words[n], "ing");
+			sorted[n] = words[n];
+			n++;
+		}
+	}
+	qsort(sorted, n, sizeof(*sorted), compare_words);
+	for (i = 0; i < n; i++)
+		counts[i] = i + 1;
+	counts[n - 1] = (size_t) 1 << 40;
+	return n;
+}
+
+/* Both hold the same words, so they must give the same prefix matches */
+static int
+same_matches(trie_t *t, const louds_t *l, const char *prefix)
+{
+	return same_words(get_prefix_matches(t, prefix),
+	    louds_prefix_matches(l, prefix));
+}
+
+int
+main(int argc, char **argv)
+{
+	static char words[2 * NWORDS][20];
+	static char *sorted[2 * NWORDS];
+	static size_t counts[2 * NWORDS];
+	const char *probes[] = { "zzzz", "aing", "ingx", "abcdefg", "b" };
+	char prefix[20];
+	trie_t *t = trie_init();
+	louds_t *l;
+	size_t i, j, n, bad;
+
+	n = make_words(words, sorted, counts);
+	trie_bulk_insert(&t, sorted, counts, n);
+	l = louds_build(sorted, counts, n);
+	check(l != NULL, "louds_build");
+	if (l == NULL)
+		return 1;
+
+	bad = 0;
+	for (i = 0; i < n; i++)
+		if (louds_get(l, sorted[i]) != trie_get(t, sorted[i]))
+			bad++;
+	check(bad == 0, "lookup: every word agrees with the trie");
+	bad = 0;
+	for (i = 0; i < sizeof(probes) / sizeof(probes[0]); i++)
+		if (louds_get(l, probes[i]) != trie_get(t, probes[i]) ||
+		    louds_prefix_len(l, probes[i]) !=
+		    trie_prefix_len(t, probes[i]))
+			bad++;
+	check(bad == 0, "lookup: absent words and prefix lengths");
+
+	/* Every prefix of every 37th word, and the prefix cut one short */
+	bad = 0;
+	for (i = 0; i < n; i += 37)
+		for (j = 1; j <= strlen(sorted[i]); j++) {
+			memcpy(prefix, sorted[i], j);
+			prefix[j] = 0;
+			if (!same_matches(t, l, prefix))
+				bad++;
+		}
+	for (i = 0; i < sizeof(probes) / sizeof(probes[0]); i++)
+		if (!same_matches(t, l, probes[i]))
+			bad++;
+	check(bad == 0, "prefix: matches agree with the trie");
+
+	/* Keys out of order are refused */
+	sorted[0] = words[1];
+	sorted[1] = words[0];
+	check(louds_build(sorted, counts, 2) == NULL,
+	    "louds_build: unsorted keys");
+
+	louds_destroy(l);
+	trie_destroy(t);
+	return test_result();
+}
@@ -38,16 +38,23 @@
 #include "libspell.h"
 
 
+/* How spell comes up with the suggestions for a misspelled word */
+#define SUGGEST_SLOW		0
+#define SUGGEST_FAST		1
+#define SUGGEST_SYMSPELL	2
+
 static void
 usage(void)
 {
-	(void) fprintf(stderr, "Usage: spell [-c number of suggestions]  [-i input_file] [-w whitelist]\n");
+	(void) fprintf(stderr, "Usage: spell [-b trie|dawg|art|louds] [-c number of suggestions] [-F] [-i input_file] [-m image] [-k cache_entries] [-s | -f] [-t threads] [-w whitelist]\n");
 	exit(1);
 }
 
 
 static void
-do_unigram(FILE *f, const char *whitelist_filepath, size_t nsuggestions, int fast)
+do_unigram(FILE *f, const char *whitelist_filepath, const char *imagepath,
+    int backend, size_t nsuggestions, int mode, size_t nthreads,
+    size_t ncached, int filter)
 {
 
 	char *word = NULL;
@@ -61,6 +68,7 @@ do_unigram(FILE *f, const char *whitelist_filepath, size_t nsuggestions, int fas
 	wc.count = 0;
 	char *sanitized_word = NULL;
 	word_list *corrections = NULL;
+	cache_stats stats;
 
 
 	while ((bytes_read = getline(&line, &linesize, f)) != -1) {
@@ -68,8 +76,26 @@ do_unigram(FILE *f, const char *whitelist_filepath, size_t nsuggestions, int fas
 		if (line[bytes_read] == '\r')
 			line[bytes_read] = 0;
 		char *templine = line;
-		if (spell == NULL)
-			spell = spell_init("dict/unigram.txt", whitelist_filepath);
+		if (spell == NULL && imagepath != NULL) {
+			spell = spell_open_image(imagepath);
+			if (spell == NULL)
+				errx(EXIT_FAILURE, "Failed to open image %s", imagepath);
+		} else if (spell == NULL) {
+			spell = spell_init_backend("dict/unigram.txt", whitelist_filepath, backend);
+			if (spell == NULL)
+				errx(EXIT_FAILURE, "Failed to load dict/unigram.txt");
+		}
+		if (nthreads > 1 && spell->pool == NULL &&
+		    spell_set_threads(spell, nthreads) < 0)
+			errx(EXIT_FAILURE, "Failed to start %zu threads", nthreads);
+		if (ncached > 0 && spell->cache == NULL)
+			spell_set_cache(spell, ncached);
+		if (filter && spell->filter == NULL)
+			spell_load_filter(spell);
+		if (mode == SUGGEST_SYMSPELL && spell->symspell == NULL &&
+		    spell_load_symspell(spell, "dict/unigram.txt", whitelist_filepath,
+		    SYMSPELL_MAXDIST, SYMSPELL_PREFIXLEN) < 0)
+			errx(EXIT_FAILURE, "Failed to build the symmetric delete index");
 		while (*templine) {
 			wordsize = strcspn(templine, " ");
 			templine[wordsize] = 0;
@@ -90,10 +116,12 @@ do_unigram(FILE *f, const char *whitelist_filepath, size_t nsuggestions, int fas
 				continue;
 			}
 
-			if (!fast)
-				corrections = spell_get_suggestions_slow(spell, sanitized_word, nsuggestions);
-			else
+			if (mode == SUGGEST_SYMSPELL)
+				corrections = spell_get_suggestions_symspell(spell, sanitized_word, nsuggestions);
+			else if (mode == SUGGEST_FAST)
 				corrections = spell_get_suggestions_fast(spell, sanitized_word, nsuggestions);
+			else
+				corrections = spell_get_suggestions_slow(spell, sanitized_word, nsuggestions);
 			word_list *node = corrections;
 			size_t i = 0;
 			if (corrections) {
@@ -119,6 +147,12 @@ do_unigram(FILE *f, const char *whitelist_filepath, size_t nsuggestions, int fas
 		free(line);
 		line = NULL;
 	}
+	if (spell != NULL && spell->cache != NULL) {
+		spell_get_cache_stats(spell, &stats);
+		fprintf(stderr, "cache: %llu hits, %llu misses, %llu evictions\n",
+		    (unsigned long long) stats.hits, (unsigned long long) stats.misses,
+		    (unsigned long long) stats.evictions);
+	}
     spell_destroy(spell);
 	free(line);
 }
@@ -128,23 +162,55 @@ main(int argc, char **argv)
 {
 	FILE *input = stdin;
 	char *whitelist_filepath = NULL;
+	char *imagepath = NULL;
+	int backend = SPELL_BACKEND_TRIE;
 	int ch;
 	size_t nsuggestions = 1;
-	int fast = 0;
+	int mode = SUGGEST_SLOW;
+	size_t nthreads = 1;
+	size_t ncached = 0;
+	int filter = 0;
 
-	while ((ch = getopt(argc, argv, "c:fi:w:")) != -1) {
+	while ((ch = getopt(argc, argv, "b:c:Ffi:k:m:st:w:")) != -1) {
 		switch (ch) {
+		case 'b':
+			if (strcmp(optarg, "trie") == 0)
+				backend = SPELL_BACKEND_TRIE;
+			else if (strcmp(optarg, "dawg") == 0)
+				backend = SPELL_BACKEND_DAWG;
+			else if (strcmp(optarg, "art") == 0)
+				backend = SPELL_BACKEND_ART;
+			else if (strcmp(optarg, "louds") == 0)
+				backend = SPELL_BACKEND_LOUDS;
+			else
+				usage();
+			break;
 		case 'c':
 			nsuggestions = strtol(optarg, NULL, 10);
 			break;
+		case 'F':
+			filter = 1;
+			break;
 		case 'f':
-			fast = 1;
+			mode = SUGGEST_FAST;
 			break;
 		case 'i':
 			input = fopen(optarg, "r");
 			if (input == NULL)
 				err(EXIT_FAILURE, "Failed to open %s", optarg);
 			break;
+		case 'k':
+			ncached = strtol(optarg, NULL, 10);
+			break;
+		case 'm':
+			imagepath = optarg;
+			break;
+		case 's':
+			mode = SUGGEST_SYMSPELL;
+			break;
+		case 't':
+			nthreads = strtol(optarg, NULL, 10);
+			break;
 		case 'w':
 			whitelist_filepath = optarg;
 			break;
@@ -154,7 +220,12 @@ main(int argc, char **argv)
 		}
 	}
 
-	do_unigram(input, whitelist_filepath, nsuggestions, fast);
+	/* The whitelist is baked into the image by dictionary -m -w */
+	if (imagepath != NULL && whitelist_filepath != NULL)
+		usage();
+
+	do_unigram(input, whitelist_filepath, imagepath, backend, nsuggestions, mode, nthreads,
+	    ncached, filter);
 	if (input != stdin)
 		fclose(input);
 	return 0;
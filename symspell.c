@@ -0,0 +1,315 @@
+/*-
+ * Copyright (c) 2017 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "distance.h"
+#include "hash.h"
+#include "symspell.h"
+
+/* Longest prefix which gets indexed, whatever the caller asks for */
+#define SYMSPELL_MAX_PREFIXLEN	32
+
+typedef struct symspell_pair {
+	uint64_t hash;
+	uint32_t word;
+} symspell_pair;
+
+/* Where the deletes of a word or of a query end up */
+typedef struct symspell_sink {
+	const symspell_t *index;
+	symspell_pair *pairs;
+	uint32_t *ids;
+	size_t n;
+	size_t size;
+	uint32_t word;
+} symspell_sink;
+
+static void *
+xrealloc(void *p, size_t nmemb, size_t size)
+{
+	if (nmemb != 0 && SIZE_MAX / nmemb < size)
+		errx(EXIT_FAILURE, "symspell: too large");
+	if ((p = realloc(p, nmemb * size)) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	return p;
+}
+
+static void
+add_pair(symspell_sink *sink, const char *s, size_t len)
+{
+	if (sink->n == sink->size) {
+		sink->size = sink->size ? sink->size * 2 : 1024;
+		sink->pairs = xrealloc(sink->pairs, sink->size, sizeof(*sink->pairs));
+	}
+	sink->pairs[sink->n].hash = fnv1a_hash(FNV1A_BASIS, s, len);
+	sink->pairs[sink->n].word = sink->word;
+	sink->n++;
+}
+
+/* Appends the words filed under the delete s[0..len) */
+static void
+add_postings(symspell_sink *sink, const char *s, size_t len)
+{
+	const symspell_t *index = sink->index;
+	uint64_t h = fnv1a_hash(FNV1A_BASIS, s, len);
+	size_t lo = 0, hi = index->nhashes, mid;
+	uint32_t p, end;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (index->hashes[mid] < h)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == index->nhashes || index->hashes[lo] != h)
+		return;
+
+	end = index->postings_start[lo + 1];
+	for (p = index->postings_start[lo]; p < end; p++) {
+		if (sink->n == sink->size) {
+			sink->size = sink->size ? sink->size * 2 : 256;
+			sink->ids = xrealloc(sink->ids, sink->size, sizeof(*sink->ids));
+		}
+		sink->ids[sink->n++] = index->postings[p];
+	}
+}
+
+/*
+ * Hands every string made by deleting at most left characters of
+ * s[0..len) to emit. Characters are deleted in increasing order of
+ * position, so the same set of deletions is not tried twice.
+ */
+static void
+gen_deletes(const char *s, size_t len, size_t start, unsigned int left,
+    void (*emit)(symspell_sink *, const char *, size_t), symspell_sink *sink)
+{
+	char next[SYMSPELL_MAX_PREFIXLEN];
+	size_t i;
+
+	emit(sink, s, len);
+	if (left == 0)
+		return;
+	for (i = start; i < len; i++) {
+		memcpy(next, s, i);
+		memcpy(next + i, s + i + 1, len - i - 1);
+		gen_deletes(next, len - 1, i, left - 1, emit, sink);
+	}
+}
+
+static int
+compare_pairs(const void *v1, const void *v2)
+{
+	const symspell_pair *p1 = v1;
+	const symspell_pair *p2 = v2;
+
+	if (p1->hash != p2->hash)
+		return p1->hash < p2->hash ? -1 : 1;
+	return p1->word < p2->word ? -1 : p1->word > p2->word;
+}
+
+static int
+compare_ids(const void *v1, const void *v2)
+{
+	uint32_t i1 = *(const uint32_t *) v1;
+	uint32_t i2 = *(const uint32_t *) v2;
+
+	return i1 < i2 ? -1 : i1 > i2;
+}
+
+/*
+ * symspell_build--
+ *  Indexes n unique words with their counts, filing each under the
+ *  deletes of at most maxdist characters of its first prefixlen ones.
+ */
+symspell_t *
+symspell_build(char **words, const size_t *counts, size_t n,
+    unsigned int maxdist, unsigned int prefixlen)
+{
+	symspell_t *index;
+	symspell_sink sink;
+	size_t i, j, len, poolsize = 0, offset = 0;
+
+	if (n >= UINT32_MAX || prefixlen == 0)
+		return NULL;
+	if (prefixlen > SYMSPELL_MAX_PREFIXLEN)
+		prefixlen = SYMSPELL_MAX_PREFIXLEN;
+	if (maxdist > prefixlen)
+		maxdist = prefixlen;
+
+	index = calloc(1, sizeof(*index));
+	if (index == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	index->maxdist = maxdist;
+	index->prefixlen = prefixlen;
+	index->nwords = n;
+
+	for (i = 0; i < n; i++)
+		poolsize += strlen(words[i]) + 1;
+	if (poolsize > UINT32_MAX)
+		errx(EXIT_FAILURE, "symspell: too large");
+	index->poolsize = poolsize;
+	index->pool = xrealloc(NULL, poolsize ? poolsize : 1, 1);
+	index->offsets = xrealloc(NULL, n ? n : 1, sizeof(*index->offsets));
+	index->counts = xrealloc(NULL, n ? n : 1, sizeof(*index->counts));
+
+	memset(&sink, 0, sizeof(sink));
+	for (i = 0; i < n; i++) {
+		len = strlen(words[i]);
+		memcpy(index->pool + offset, words[i], len + 1);
+		index->offsets[i] = offset;
+		index->counts[i] = counts[i] > UINT32_MAX ? UINT32_MAX : counts[i];
+		offset += len + 1;
+
+		sink.word = i;
+		gen_deletes(words[i], len < prefixlen ? len : prefixlen, 0,
+		    maxdist, add_pair, &sink);
+	}
+
+	/* Sorting brings the words filed under one delete together */
+	qsort(sink.pairs, sink.n, sizeof(*sink.pairs), compare_pairs);
+	index->hashes = xrealloc(NULL, sink.n + 1, sizeof(*index->hashes));
+	index->postings_start = xrealloc(NULL, sink.n + 2,
+	    sizeof(*index->postings_start));
+	index->postings = xrealloc(NULL, sink.n + 1, sizeof(*index->postings));
+	for (i = 0, j = 0; i < sink.n; i++) {
+		if (i > 0 && sink.pairs[i].hash == sink.pairs[i - 1].hash) {
+			if (sink.pairs[i].word == sink.pairs[i - 1].word)
+				continue;
+		} else {
+			index->hashes[index->nhashes] = sink.pairs[i].hash;
+			index->postings_start[index->nhashes++] = j;
+		}
+		index->postings[j++] = sink.pairs[i].word;
+	}
+	index->postings_start[index->nhashes] = j;
+	free(sink.pairs);
+
+	index->hashes = xrealloc(index->hashes, index->nhashes + 1,
+	    sizeof(*index->hashes));
+	index->postings_start = xrealloc(index->postings_start,
+	    index->nhashes + 1, sizeof(*index->postings_start));
+	index->postings = xrealloc(index->postings, j + 1,
+	    sizeof(*index->postings));
+	return index;
+}
+
+static int
+compare_matches(const void *v1, const void *v2)
+{
+	const symspell_match *m1 = v1;
+	const symspell_match *m2 = v2;
+
+	if (m1->distance != m2->distance)
+		return m1->distance < m2->distance ? -1 : 1;
+	if (m1->count != m2->count)
+		return m1->count > m2->count ? -1 : 1;
+	return strcmp(m1->word, m2->word);
+}
+
+/*
+ * symspell_lookup--
+ *  Returns the indexed words within maxdist edits of word, closest and
+ *  then most frequent first, and stores their number in *nmatches. The
+ *  array is the caller's to free; the words in it belong to the index.
+ */
+symspell_match *
+symspell_lookup(const symspell_t *index, const char *word, size_t *nmatches)
+{
+	symspell_sink sink;
+	symspell_match *matches = NULL;
+	const char *candidate;
+	size_t len = strlen(word), clen, i, n = 0, distance;
+
+	*nmatches = 0;
+	if (index == NULL)
+		return NULL;
+
+	memset(&sink, 0, sizeof(sink));
+	sink.index = index;
+	gen_deletes(word, len < index->prefixlen ? len : index->prefixlen, 0,
+	    index->maxdist, add_postings, &sink);
+	if (sink.n == 0)
+		return NULL;
+
+	qsort(sink.ids, sink.n, sizeof(*sink.ids), compare_ids);
+	for (i = 0; i < sink.n; i++) {
+		if (i > 0 && sink.ids[i] == sink.ids[i - 1])
+			continue;
+		candidate = index->pool + index->offsets[sink.ids[i]];
+		clen = strlen(candidate);
+		if (clen > len + index->maxdist || len > clen + index->maxdist)
+			continue;
+		distance = osa_distance_bounded(word, len, candidate, clen,
+		    index->maxdist);
+		if (distance > index->maxdist)
+			continue;
+		if (matches == NULL)
+			matches = xrealloc(NULL, sink.n, sizeof(*matches));
+		matches[n].word = candidate;
+		matches[n].count = index->counts[sink.ids[i]];
+		matches[n].distance = distance;
+		n++;
+	}
+	free(sink.ids);
+
+	if (n > 1)
+		qsort(matches, n, sizeof(*matches), compare_matches);
+	*nmatches = n;
+	return matches;
+}
+
+/* Bytes used by the index, to size maxdist and prefixlen against */
+size_t
+symspell_memory(const symspell_t *index)
+{
+	return sizeof(*index) + index->poolsize +
+	    index->nwords * (sizeof(*index->offsets) + sizeof(*index->counts)) +
+	    index->nhashes * (sizeof(*index->hashes) +
+		sizeof(*index->postings_start)) +
+	    index->postings_start[index->nhashes] * sizeof(*index->postings);
+}
+
+void
+symspell_destroy(symspell_t *index)
+{
+	if (index == NULL)
+		return;
+	free(index->pool);
+	free(index->offsets);
+	free(index->counts);
+	free(index->hashes);
+	free(index->postings_start);
+	free(index->postings);
+	free(index);
+}
@@ -0,0 +1,78 @@
+/*-
+ * Copyright (c) 2017 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef SYMSPELL_H
+#define SYMSPELL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A symmetric delete index: every word is filed under each string which
+ * can be made out of its first prefixlen characters by deleting at most
+ * maxdist of them. Two words within maxdist edits of each other share at
+ * least one such delete, so looking up the deletes of a misspelling
+ * yields every candidate correction without generating any inserts,
+ * replaces or transposes. Only hashes of the deletes are kept; whatever
+ * shows up is verified with a real distance computation.
+ *
+ * Memory grows with maxdist and prefixlen, which bound the number of
+ * deletes per word.
+ */
+#define SYMSPELL_MAXDIST	2
+#define SYMSPELL_PREFIXLEN	7
+
+typedef struct symspell_t {
+	char *pool;
+	size_t poolsize;
+	uint32_t *offsets;
+	uint32_t *counts;
+	uint32_t nwords;
+	uint64_t *hashes;	/* sorted */
+	uint32_t *postings_start;
+	uint32_t *postings;
+	size_t nhashes;
+	unsigned int maxdist;
+	unsigned int prefixlen;
+} symspell_t;
+
+/* word points into the index and stays valid as long as it does */
+typedef struct symspell_match {
+	const char *word;
+	size_t count;
+	size_t distance;
+} symspell_match;
+
+symspell_t *symspell_build(char **, const size_t *, size_t, unsigned int,
+    unsigned int);
+symspell_match *symspell_lookup(const symspell_t *, const char *, size_t *);
+size_t symspell_memory(const symspell_t *);
+void symspell_destroy(symspell_t *);
+
+#endif
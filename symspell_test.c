@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "distance.h"
+#include "symspell.h"
+#include "test_util.h"
+#include "trie.h"
+
+/*
+ * Every fifth word also comes with an "ations" ending, which takes it past
+ * the indexed prefix.
+ */
+static size_t
+make_words(char words[][20], char **list, size_t *counts)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < NWORDS; i++) {
+		make_word(i, words[n]);
+		list[n] = words[n];
+		n++;
+		if (i % 5 == 0) {
+			make_word(i, words[n]);
+			strcat(words[n], "ations");
+			list[n] = words[n];
+			n++;
+		}
+	}
+	for (i = 0; i < n; i++)
+		counts[i] = (i * 7919) % 1000 + 1;
+	return n;
+}
+
+/*
+ * The lookup must return exactly the words a scan of the whole list finds
+ * within maxdist, with their trie counts, closest and most frequent first.
+ */
+static int
+same_as_scan(const symspell_t *index, trie_t *t, char **list, size_t n,
+    const char *query)
+{
+	symspell_match *matches;
+	size_t i, j, nmatches, expected = 0, d;
+	size_t len = strlen(query);
+	int ok = 1;
+
+	matches = symspell_lookup(index, query, &nmatches);
+	for (i = 0; i < n; i++) {
+		d = osa_distance(query, len, list[i], strlen(list[i]));
+		if (d > index->maxdist)
+			continue;
+		expected++;
+		for (j = 0; j < nmatches; j++)
+			if (strcmp(matches[j].word, list[i]) == 0)
+				break;
+		if (j == nmatches || matches[j].distance != d ||
+		    matches[j].count != trie_get(t, list[i]))
+			ok = 0;
+	}
+	if (nmatches != expected)
+		ok = 0;
+	for (i = 1; ok && i < nmatches; i++)
+		if (matches[i].distance < matches[i - 1].distance ||
+		    (matches[i].distance == matches[i - 1].distance &&
+		    matches[i].count > matches[i - 1].count))
+			ok = 0;
+	free(matches);
+	return ok;
+}
+
+/* Runs the words of the list and some misspellings of them by the index */
+static size_t
+bad_lookups(const symspell_t *index, trie_t *t, char **list, size_t n)
+{
+	const char *probes[] = { "", "q", "zzzzz", "aations", "baxations",
+	    "abcdefghij" };
+	char query[24];
+	size_t i, len, bad = 0;
+
+	for (i = 0; i < sizeof(probes) / sizeof(probes[0]); i++)
+		if (!same_as_scan(index, t, list, n, probes[i]))
+			bad++;
+	for (i = 0; i < n; i += 47) {
+		len = strlen(list[i]);
+		if (!same_as_scan(index, t, list, n, list[i]))
+			bad++;
+		/* A deletion, a transposition and an insertion */
+		memcpy(query, list[i] + 1, len);
+		if (!same_as_scan(index, t, list, n, query))
+			bad++;
+		if (len > 1) {
+			memcpy(query, list[i], len + 1);
+			query[len - 2] = list[i][len - 1];
+			query[len - 1] = list[i][len - 2];
+			if (!same_as_scan(index, t, list, n, query))
+				bad++;
+		}
+		memcpy(query + 1, list[i], len + 1);
+		query[0] = 'x';
+		if (!same_as_scan(index, t, list, n, query))
+			bad++;
+	}
+	return bad;
+}
+
+int
+main(int argc, char **argv)
+{
+	static char words[2 * NWORDS][20];
+	static char *list[2 * NWORDS];
+	static size_t counts[2 * NWORDS];
+	symspell_t *index;
+	trie_t *t = trie_init();
+	size_t i, n;
+
+	n = make_words(words, list, counts);
+	for (i = 0; i < n; i++)
+		trie_insert(&t, list[i], counts[i]);
+
+	index = symspell_build(list, counts, n, SYMSPELL_MAXDIST,
+	    SYMSPELL_PREFIXLEN);
+	check(index != NULL && index->maxdist == SYMSPELL_MAXDIST,
+	    "symspell_build");
+	check(bad_lookups(index, t, list, n) == 0,
+	    "lookup: agrees with a scan of the word list");
+	symspell_destroy(index);
+
+	/* A short prefix leaves most of every longer word unindexed */
+	index = symspell_build(list, counts, n, 1, 3);
+	check(bad_lookups(index, t, list, n) == 0,
+	    "lookup: agrees with a scan with a short prefix");
+	symspell_destroy(index);
+
+	/* maxdist is capped at the prefix length */
+	index = symspell_build(list, counts, n, 5, 2);
+	check(index->maxdist == 2, "symspell_build: maxdist capped");
+	symspell_destroy(index);
+	check(symspell_build(list, counts, n, 1, 0) == NULL,
+	    "symspell_build: empty prefix");
+
+	trie_destroy(t);
+	return test_result();
+}
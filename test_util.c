@@ -0,0 +1,120 @@
+/*-
+ * Copyright (c) 2017 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_util.h"
+
+static int failures;
+
+void
+check(int ok, const char *what)
+{
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+int
+test_result(void)
+{
+	if (failures > 0) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * make_word--
+ *  Spells i + 1 in bijective base 26 into buf, which gives every i its
+ *  own word: a to z, then aa to zz and so on. NWORDS of them take at most
+ *  three letters.
+ */
+void
+make_word(size_t i, char *buf)
+{
+	char tmp[16];
+	size_t len = 0, j;
+
+	for (i++; i > 0; i = (i - 1) / 26)
+		tmp[len++] = 'a' + (i - 1) % 26;
+	for (j = 0; j < len; j++)
+		buf[j] = tmp[len - 1 - j];
+	buf[len] = 0;
+}
+
+/* qsort(3) comparator for an array of words */
+int
+compare_words(const void *v1, const void *v2)
+{
+	return strcmp(*(char * const *) v1, *(char * const *) v2);
+}
+
+/* Number of words in a NULL terminated list, which may itself be NULL */
+size_t
+count_words(char **words)
+{
+	size_t n;
+
+	for (n = 0; words != NULL && words[n] != NULL; n++)
+		;
+	return n;
+}
+
+void
+free_words(char **words)
+{
+	size_t i;
+
+	for (i = 0; words != NULL && words[i] != NULL; i++)
+		free(words[i]);
+	free(words);
+}
+
+/*
+ * same_words--
+ *  Tells whether two NULL terminated lists hold the same words in the
+ *  same order, an empty list matching NULL, and frees both.
+ */
+int
+same_words(char **expected, char **got)
+{
+	size_t i, n = count_words(expected);
+	int ok = n == count_words(got);
+
+	for (i = 0; ok && i < n; i++)
+		ok = strcmp(expected[i], got[i]) == 0;
+	free_words(expected);
+	free_words(got);
+	return ok;
+}
@@ -27,159 +27,939 @@
  * SUCH DAMAGE.
  */
 
+#include <err.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "trie.h"
 
+#define TRIE_INITIAL_SIZE 1024
+
+/* Number of lookups trie_get_batch keeps in flight */
+#define TRIE_BATCH 16
+
+/*
+ * Returns the index of a fresh node at the end of the arena, growing it
+ * if needed. Pointers into t->nodes are invalidated by this call.
+ */
+static uint32_t
+trie_alloc_node(trie_t *t, char c)
+{
+	trie_node_t *n;
+
+	if (t->nnodes == t->size) {
+		if (t->size > UINT32_MAX / 2)
+			errx(EXIT_FAILURE, "trie: too many nodes");
+		n = realloc(t->nodes, 2 * t->size * sizeof(*n));
+		if (n == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+		t->nodes = n;
+		t->size *= 2;
+	}
+	n = &t->nodes[t->nnodes];
+	memset(n, 0, sizeof(*n));
+	n->character = c;
+	return t->nnodes++;
+}
+
 trie_t *
 trie_init(void)
 {
-	return calloc(1, sizeof(trie_t));
+	trie_t *t = malloc(sizeof(*t));
+	if (t == NULL)
+		return NULL;
+	t->nodes = calloc(TRIE_INITIAL_SIZE, sizeof(*t->nodes));
+	if (t->nodes == NULL) {
+		free(t);
+		return NULL;
+	}
+	t->size = TRIE_INITIAL_SIZE;
+	/* The root, with character 0 until the first key goes in */
+	t->nnodes = 1;
+	return t;
+}
+
+/*
+ * Wraps an existing array of nodes, such as the one in a mapped dictionary
+ * image, without copying it. The nodes must outlive the returned trie.
+ */
+trie_t *
+trie_map(trie_node_t *nodes, uint32_t nnodes)
+{
+	trie_t *t;
+
+	if (nodes == NULL || nnodes == 0)
+		return NULL;
+	if ((t = malloc(sizeof(*t))) == NULL)
+		return NULL;
+	t->nodes = nodes;
+	t->nnodes = nnodes;
+	t->size = 0;
+	return t;
+}
+
+/*
+ * trie_clone--
+ *  Returns a writable copy of t, which may itself be read-only, e.g.
+ *  mapped from an image. The copy shares nothing with t.
+ */
+trie_t *
+trie_clone(const trie_t *t)
+{
+	trie_t *c;
+	uint32_t size = TRIE_INITIAL_SIZE;
+
+	while (size < t->nnodes) {
+		if (size > UINT32_MAX / 2)
+			errx(EXIT_FAILURE, "trie: too many nodes");
+		size *= 2;
+	}
+	if ((c = malloc(sizeof(*c))) == NULL)
+		return NULL;
+	if ((c->nodes = malloc(size * sizeof(*c->nodes))) == NULL) {
+		free(c);
+		return NULL;
+	}
+	memcpy(c->nodes, t->nodes, t->nnodes * sizeof(*c->nodes));
+	c->nnodes = t->nnodes;
+	c->size = size;
+	return c;
 }
 
 void
 trie_insert(trie_t **trie, const char *key, size_t value)
 {
-	char c = key[0];
 	trie_t *t;
+	trie_node_t *n;
+	uint32_t idx = 0;
+	uint32_t next;
+	char c;
+
 	if (*trie == NULL)
 		*trie = trie_init();
-
 	t = *trie;
 
-	if (t->character == 0)
-		t->character = c;
+	if (key[0] == 0)
+		return;
+
+	if (t->size == 0) {
+		warnx("trie: cannot insert into a read-only trie");
+		return;
+	}
 
-	if (c > t->character)
-		return trie_insert(&(t->right), key, value);
+	if (t->nodes[0].character == 0)
+		t->nodes[0].character = key[0];
 
-	if (c < t->character)
-		return trie_insert(&(t->left), key, value);
+	if (value > UINT32_MAX)
+		value = UINT32_MAX;
 
-	if (key[1]  == 0) {
-		t->value = value;
-		return;
-	} else
-		return trie_insert(&(t->middle), key + 1, value);
+	for (;;) {
+		c = *key;
+		n = &t->nodes[idx];
+		if (n->best < value)
+			n->best = value;
+		if (c == n->character) {
+			if (key[1] == 0) {
+				n->value = value;
+				return;
+			}
+			key++;
+			if ((next = n->middle) == TRIE_NIL) {
+				next = trie_alloc_node(t, *key);
+				t->nodes[idx].middle = next;
+			}
+		} else if (c > n->character) {
+			if ((next = n->right) == TRIE_NIL) {
+				next = trie_alloc_node(t, c);
+				t->nodes[idx].right = next;
+			}
+		} else {
+			if ((next = n->left) == TRIE_NIL) {
+				next = trie_alloc_node(t, c);
+				t->nodes[idx].left = next;
+			}
+		}
+		idx = next;
+	}
+}
+
+static void
+bulk_insert(trie_t **t, char **keys, const size_t *values, size_t lo, size_t hi)
+{
+	size_t mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		trie_insert(t, keys[mid], values[mid]);
+		bulk_insert(t, keys, values, lo, mid);
+		lo = mid + 1;
+	}
+}
+
+/*
+ * trie_bulk_insert--
+ *  Inserts n keys which are sorted, as a dictionary file usually is.
+ *  Inserting them in that order would make every sibling list of the
+ *  ternary tree a long chain leaning right, so the keys go in median
+ *  first instead: each character comparison then halves the remaining
+ *  words, and the siblings at every level form a tree of logarithmic
+ *  depth, weighted by how many words sit under each character.
+ */
+void
+trie_bulk_insert(trie_t **t, char **keys, const size_t *values, size_t n)
+{
+	bulk_insert(t, keys, values, 0, n);
 }
 
 size_t
-trie_get(trie_t * t, const char *key)
+trie_get(trie_t *t, const char *key)
 {
-	char c = key[0];
-	if (t == NULL)
-		return 0;
+	const trie_node_t *n;
+	uint32_t idx = 0;
+	char c;
 
-	if (t->character == 0)
+	if (t == NULL || t->nodes[0].character == 0)
 		return 0;
 
-	if (c == t->character) {
-		if (key[1] == 0)
-			return t->value;
+	for (;;) {
+		c = *key;
+		n = &t->nodes[idx];
+		if (c == n->character) {
+			if (key[1] == 0)
+				return n->value;
+			key++;
+			idx = n->middle;
+		} else if (c > n->character)
+			idx = n->right;
 		else
-			return trie_get(t->middle, key + 1);
+			idx = n->left;
+
+		if (idx == TRIE_NIL)
+			return 0;
 	}
+}
+
+/*
+ * trie_get_batch--
+ *  Looks up n keys at once, storing the count of keys[i] (0 if absent) in
+ *  counts[i]. Up to TRIE_BATCH lookups advance in lockstep, one node each
+ *  per round, and the next node of every lookup is prefetched before
+ *  moving on to the others, so that the cache misses of independent keys
+ *  overlap instead of being paid one after the other.
+ */
+void
+trie_get_batch(trie_t *t, char **keys, size_t n, size_t *counts)
+{
+	const char *key[TRIE_BATCH];
+	uint32_t idx[TRIE_BATCH];
+	size_t slot[TRIE_BATCH];
+	const trie_node_t *node;
+	size_t next = 0, active = 0, i;
+	char c;
+
+	if (t == NULL || t->nodes[0].character == 0) {
+		for (i = 0; i < n; i++)
+			counts[i] = 0;
+		return;
+	}
+
+	while (next < n || active > 0) {
+		while (active < TRIE_BATCH && next < n) {
+			key[active] = keys[next];
+			idx[active] = 0;
+			slot[active] = next++;
+			active++;
+		}
 
-	if (c > t->character)
-		return trie_get(t->right, key);
+		for (i = 0; i < active;) {
+			node = &t->nodes[idx[i]];
+			c = *key[i];
+			if (c == node->character) {
+				if (key[i][1] == 0) {
+					counts[slot[i]] = node->value;
+					goto done;
+				}
+				key[i]++;
+				idx[i] = node->middle;
+			} else if (c > node->character)
+				idx[i] = node->right;
+			else
+				idx[i] = node->left;
 
-	return trie_get(t->left, key);
+			if (idx[i] == TRIE_NIL) {
+				counts[slot[i]] = 0;
+				goto done;
+			}
+			__builtin_prefetch(&t->nodes[idx[i]]);
+			i++;
+			continue;
+done:
+			/* Retire the lookup, the last lane takes its place */
+			active--;
+			key[i] = key[active];
+			idx[i] = idx[active];
+			slot[i] = slot[active];
+		}
+	}
 }
 
+/*
+ * All the nodes are in one arena, so tearing down the dictionary is a
+ * couple of free(3) calls no matter how many words it holds.
+ */
 void
 trie_destroy(trie_t *t)
 {
-	if (t->left)
-		trie_destroy(t->left);
-	if (t->middle)
-		trie_destroy(t->middle);
-	if (t->right)
-		trie_destroy(t->right);
+	if (t == NULL)
+		return;
+	if (t->size != 0)
+		free(t->nodes);
 	free(t);
 }
 
-trie_t *
+trie_node_t *
 get_subtrie(trie_t *t, const char *key)
 {
-	char c = key[0];
-	if (t == NULL)
-		return NULL;
+	trie_node_t *n;
+	uint32_t idx = 0;
+	char c;
 
-	if (key[0] == 0)
+	if (t == NULL || key[0] == 0)
 		return NULL;
 
-	if (t->character == 0)
+	if (t->nodes[0].character == 0)
 		return NULL;
 
-	if (c == t->character) {
-		if (key[1] == 0)
-			return t;
+	for (;;) {
+		c = *key;
+		n = &t->nodes[idx];
+		if (c == n->character) {
+			if (key[1] == 0)
+				return n;
+			key++;
+			idx = n->middle;
+		} else if (c > n->character)
+			idx = n->right;
 		else
-			return get_subtrie(t->middle, key + 1);
+			idx = n->left;
+
+		if (idx == TRIE_NIL)
+			return NULL;
 	}
+}
 
-	if (c > t->character)
-		return get_subtrie(t->right, key);
+/*
+ * trie_prefix_len--
+ *  Returns the length of the longest prefix of key that some word of the
+ *  trie starts with. Past it no edit of key can lead back to a word.
+ */
+size_t
+trie_prefix_len(trie_t *t, const char *key)
+{
+	const trie_node_t *n;
+	uint32_t idx = 0;
+	size_t len = 0;
+
+	if (t == NULL || t->nodes[0].character == 0)
+		return 0;
 
-	return get_subtrie(t->left, key);
+	while (key[len] != 0) {
+		n = &t->nodes[idx];
+		if (key[len] == n->character) {
+			len++;
+			idx = n->middle;
+		} else if (key[len] > n->character)
+			idx = n->right;
+		else
+			idx = n->left;
+
+		if (idx == TRIE_NIL)
+			break;
+	}
+	return len;
+}
+
+/*
+ * An entry of the priority queue of trie_top_completions: either a word
+ * ready to be returned, or a whole subtree whose words are at most as
+ * frequent as its best value. Words are spelled by following the parent
+ * links of the path entries.
+ */
+typedef struct topk_entry {
+	uint32_t priority;
+	uint32_t node;
+	uint32_t path;
+	int is_word;
+} topk_entry;
+
+typedef struct topk_path {
+	uint32_t parent;
+	char character;
+} topk_path;
+
+typedef struct topk_state {
+	topk_entry *heap;
+	size_t nheap;
+	size_t heap_size;
+	topk_path *paths;
+	size_t npaths;
+	size_t paths_size;
+} topk_state;
+
+static int
+topk_before(const topk_entry *e1, const topk_entry *e2)
+{
+	if (e1->priority != e2->priority)
+		return e1->priority > e2->priority;
+	/* On a tie, hand out the word before opening more subtrees */
+	return e1->is_word > e2->is_word;
 }
 
 static void
-collect(trie_t *t, const char *prefix, char **list, size_t *list_offset, size_t *list_size)
+topk_push(topk_state *s, uint32_t priority, uint32_t node, uint32_t path, int is_word)
 {
-	if (t == NULL)
-		return;
+	topk_entry e, *heap;
+	size_t i, parent;
+
+	if (s->nheap == s->heap_size) {
+		s->heap_size = s->heap_size ? s->heap_size * 2 : 64;
+		heap = realloc(s->heap, s->heap_size * sizeof(*heap));
+		if (heap == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+		s->heap = heap;
+	}
+	e.priority = priority;
+	e.node = node;
+	e.path = path;
+	e.is_word = is_word;
+	for (i = s->nheap++; i > 0; i = parent) {
+		parent = (i - 1) / 2;
+		if (!topk_before(&e, &s->heap[parent]))
+			break;
+		s->heap[i] = s->heap[parent];
+	}
+	s->heap[i] = e;
+}
+
+static topk_entry
+topk_pop(topk_state *s)
+{
+	topk_entry top = s->heap[0];
+	topk_entry last = s->heap[--s->nheap];
+	size_t i = 0, child;
 
-	collect(t->left, prefix, list, list_offset, list_size);
-	char *new_prefix = NULL;
-	asprintf(&new_prefix, "%s%c", prefix, t->character);
-	if (t->value != 0) {
-		if ((*list_offset) == (*list_size)) {
-			size_t newsize = (*list_size) + 16;
-			list = realloc(list, sizeof(*list) * newsize);
-			*list_size = newsize;
+	while ((child = 2 * i + 1) < s->nheap) {
+		if (child + 1 < s->nheap && topk_before(&s->heap[child + 1], &s->heap[child]))
+			child++;
+		if (!topk_before(&s->heap[child], &last))
+			break;
+		s->heap[i] = s->heap[child];
+		i = child;
+	}
+	s->heap[i] = last;
+	return top;
+}
+
+static uint32_t
+topk_add_path(topk_state *s, uint32_t parent, char c)
+{
+	topk_path *paths;
+
+	if (s->npaths == s->paths_size) {
+		s->paths_size *= 2;
+		paths = realloc(s->paths, s->paths_size * sizeof(*paths));
+		if (paths == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+		s->paths = paths;
+	}
+	s->paths[s->npaths].parent = parent;
+	s->paths[s->npaths].character = c;
+	return s->npaths++;
+}
+
+static char *
+topk_spell(const topk_state *s, const char *prefix, size_t prefixlen, uint32_t path)
+{
+	size_t len = prefixlen;
+	uint32_t p;
+	char *word;
+
+	for (p = path; p != 0; p = s->paths[p].parent)
+		len++;
+	if ((word = malloc(len + 1)) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	memcpy(word, prefix, prefixlen);
+	word[len] = 0;
+	for (p = path; p != 0; p = s->paths[p].parent)
+		word[--len] = s->paths[p].character;
+	return word;
+}
+
+/*
+ * trie_top_completions--
+ *  Returns up to k words starting with prefix, most frequent first, along
+ *  with their counts. This is a best-first search over the subtree of the
+ *  prefix ordered by the best value of the nodes, so it only opens the
+ *  subtrees which can still hold one of the k most frequent words. The
+ *  number of results is stored in *nmatches; release them with
+ *  free_trie_matches.
+ */
+trie_match *
+trie_top_completions(trie_t *t, const char *prefix, size_t k, size_t *nmatches)
+{
+	topk_state s;
+	topk_entry e;
+	trie_node_t *subtrie, *n;
+	trie_match *matches;
+	size_t prefixlen, count = 0;
+	uint32_t path;
+
+	*nmatches = 0;
+	if (t == NULL || prefix == NULL || k == 0)
+		return NULL;
+	if ((subtrie = get_subtrie(t, prefix)) == NULL)
+		return NULL;
+
+	prefixlen = strlen(prefix);
+	matches = calloc(k, sizeof(*matches));
+	s.heap = NULL;
+	s.nheap = s.heap_size = 0;
+	s.paths_size = 64;
+	s.paths = malloc(s.paths_size * sizeof(*s.paths));
+	if (matches == NULL || s.paths == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	/* Path 0 spells the prefix itself */
+	s.npaths = 1;
+
+	if (subtrie->value != 0)
+		topk_push(&s, subtrie->value, 0, 0, 1);
+	if (subtrie->middle != TRIE_NIL)
+		topk_push(&s, t->nodes[subtrie->middle].best, subtrie->middle, 0, 0);
+
+	while (count < k && s.nheap > 0) {
+		e = topk_pop(&s);
+		if (e.is_word) {
+			matches[count].word = topk_spell(&s, prefix, prefixlen, e.path);
+			matches[count].count = e.priority;
+			matches[count].distance = 0;
+			count++;
+			continue;
 		}
-		list[*list_offset] = new_prefix;
-		(*list_offset)++;
+
+		n = &t->nodes[e.node];
+		path = topk_add_path(&s, e.path, n->character);
+		if (n->value != 0)
+			topk_push(&s, n->value, e.node, path, 1);
+		if (n->middle != TRIE_NIL)
+			topk_push(&s, t->nodes[n->middle].best, n->middle, path, 0);
+		if (n->left != TRIE_NIL)
+			topk_push(&s, t->nodes[n->left].best, n->left, e.path, 0);
+		if (n->right != TRIE_NIL)
+			topk_push(&s, t->nodes[n->right].best, n->right, e.path, 0);
 	}
 
-	collect(t->middle, new_prefix, list, list_offset, list_size);
-	collect(t->right, prefix, list, list_offset, list_size);
+	free(s.heap);
+	free(s.paths);
+	if (count == 0) {
+		free(matches);
+		return NULL;
+	}
+	*nmatches = count;
+	return matches;
 }
 
+/*
+ * Appends the smallest word of the tree rooted at idx to the one spelled
+ * by the first len bytes of the iterator buffer. With skip_left set, the
+ * left subtree of idx is not part of the tree. If the word does not fit,
+ * the buffer is left holding as much of it as does, none of whose
+ * extensions fit either, and the next step skips them.
+ */
 static int
-_compare_strings(const void *v1, const void *v2)
+iter_first(trie_iter *it, uint32_t idx, size_t len, int skip_left, size_t *count)
 {
-	const char *s1 = (const char *) v1;
-	const char *s2 = (const char *) v2;
-	int retval = strcmp(s1, s2);
-	return retval == 0? 0: retval * -1;
+	const trie_node_t *nodes = it->trie->nodes;
+	const trie_node_t *n;
+
+	for (;;) {
+		n = &nodes[idx];
+		if (!skip_left) {
+			while (n->left != TRIE_NIL)
+				n = &nodes[n->left];
+		}
+		skip_left = 0;
+		if (len + 1 >= it->bufsize) {
+			it->buf[len] = 0;
+			it->len = len;
+			it->truncated = 1;
+			return -1;
+		}
+		it->buf[len++] = n->character;
+		if (n->value != 0)
+			break;
+		if ((idx = n->middle) == TRIE_NIL) {
+			it->done = 1;
+			return 0;
+		}
+	}
+	it->buf[len] = 0;
+	it->len = len;
+	if (count != NULL)
+		*count = n->value;
+	return 1;
 }
 
+/*
+ * trie_iter_init--
+ *  Sets up it to walk the words of t starting with prefix in ascending
+ *  order. The words are spelled in buf, which must be large enough for
+ *  the longest of them and stays owned by the caller.
+ *
+ *  The last word returned is all the state the iterator needs, so it is
+ *  also the resume token: passing it as resume continues the walk right
+ *  after it, even in another iterator. resume must start with prefix;
+ *  NULL starts from the beginning.
+ *
+ *  Returns -1 if the prefix or the resume token do not fit in buf.
+ */
+int
+trie_iter_init(trie_iter *it, trie_t *t, const char *prefix,
+    const char *resume, char *buf, size_t bufsize)
+{
+	const char *start = resume != NULL ? resume : prefix;
+	size_t len = strlen(start);
+
+	it->trie = t;
+	it->buf = buf;
+	it->bufsize = bufsize;
+	it->prefixlen = strlen(prefix);
+	it->done = t == NULL || t->nodes[0].character == 0;
+	it->started = resume != NULL && resume[0] != 0;
+	it->truncated = 0;
+	if (len >= bufsize || strncmp(start, prefix, it->prefixlen) != 0) {
+		it->done = 1;
+		return -1;
+	}
+	memcpy(buf, start, len + 1);
+	it->len = len;
+	return 0;
+}
+
+/*
+ * trie_iter_next--
+ *  Moves to the next word and leaves it in the iterator buffer, storing
+ *  its value in *count when count is not NULL. Returns 1 on success, 0
+ *  when there are no more words and -1 when the next word does not fit in
+ *  the buffer. The words which do not fit are skipped, so the walk can go
+ *  on with the next call; the buffer then holds the part of the skipped
+ *  word which fits.
+ *
+ *  Nothing is allocated and no stack of nodes is kept: the successor of
+ *  the current word is found by walking it down from the root again and
+ *  remembering the last place where the trie branches off to a larger
+ *  word.
+ */
+int
+trie_iter_next(trie_iter *it, size_t *count)
+{
+	const trie_node_t *nodes, *n;
+	uint32_t idx = 0, next, cand = TRIE_NIL;
+	size_t i = 0, cand_len = 0;
+	int found = 0, cand_skip = 0;
+	char c;
+
+	if (it->done)
+		return 0;
+	nodes = it->trie->nodes;
+
+	if (!it->started) {
+		it->started = 1;
+		if (it->len == 0)
+			return iter_first(it, 0, 0, 0, count);
+		/* The first word is the prefix itself or its smallest extension */
+		for (;;) {
+			n = &nodes[idx];
+			c = it->buf[i];
+			if (c == n->character) {
+				if (++i == it->len)
+					break;
+				next = n->middle;
+			} else if (c > n->character)
+				next = n->right;
+			else
+				next = n->left;
+			if (next == TRIE_NIL) {
+				it->done = 1;
+				return 0;
+			}
+			idx = next;
+		}
+		if (n->value != 0) {
+			if (count != NULL)
+				*count = n->value;
+			return 1;
+		}
+		if (n->middle == TRIE_NIL) {
+			it->done = 1;
+			return 0;
+		}
+		return iter_first(it, n->middle, it->len, 0, count);
+	}
+
+	/*
+	 * Branches off at depth i keep the prefix only once i is past it, and
+	 * the later a branch is met on the way down, the smaller the words
+	 * under it.
+	 */
+	while (i < it->len) {
+		n = &nodes[idx];
+		c = it->buf[i];
+		if (c < n->character) {
+			if (i >= it->prefixlen) {
+				cand = idx;
+				cand_len = i;
+				cand_skip = 1;
+				found = 1;
+			}
+			next = n->left;
+		} else if (c > n->character) {
+			next = n->right;
+		} else {
+			if (n->right != TRIE_NIL && i >= it->prefixlen) {
+				cand = n->right;
+				cand_len = i;
+				cand_skip = 0;
+				found = 1;
+			}
+			if (++i == it->len) {
+				if (n->middle != TRIE_NIL && !it->truncated) {
+					cand = n->middle;
+					cand_len = i;
+					cand_skip = 0;
+					found = 1;
+				}
+				break;
+			}
+			next = n->middle;
+		}
+		if (next == TRIE_NIL)
+			break;
+		idx = next;
+	}
+
+	it->truncated = 0;
+	if (!found) {
+		it->done = 1;
+		return 0;
+	}
+	return iter_first(it, cand, cand_len, cand_skip, count);
+}
+
+/*
+ * get_prefix_matches--
+ *  Returns the NULL terminated list of the words of t starting with
+ *  prefix in ascending order, or NULL if there are none.
+ */
 char **
 get_prefix_matches(trie_t *t, const char *prefix)
 {
+	trie_iter it;
+	char *buf, *newbuf;
+	char **list, **newlist;
+	size_t bufsize = TRIE_MAX_WORD;
+	size_t list_size = 16;
+	size_t list_offset = 0;
+	int rv;
+
 	if (t == NULL || prefix == NULL)
 		return NULL;
+	while (strlen(prefix) >= bufsize)
+		bufsize *= 2;
 
-	trie_t *subtrie = get_subtrie(t, prefix);
-	if (subtrie == NULL)
+	buf = malloc(bufsize);
+	list = malloc(list_size * sizeof(*list));
+	if (buf == NULL || list == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	trie_iter_init(&it, t, prefix, NULL, buf, bufsize);
+	while ((rv = trie_iter_next(&it, NULL)) != 0) {
+		if (rv < 0) {
+			/* Start over right after the last word, with more room */
+			bufsize *= 2;
+			if ((newbuf = realloc(buf, bufsize)) == NULL)
+				err(EXIT_FAILURE, "malloc failed");
+			buf = newbuf;
+			trie_iter_init(&it, t, prefix,
+			    list_offset > 0 ? list[list_offset - 1] : NULL, buf, bufsize);
+			continue;
+		}
+		if (list_offset + 1 == list_size) {
+			list_size *= 2;
+			newlist = realloc(list, list_size * sizeof(*list));
+			if (newlist == NULL)
+				err(EXIT_FAILURE, "malloc failed");
+			list = newlist;
+		}
+		if ((list[list_offset++] = strdup(buf)) == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+	}
+	free(buf);
+
+	if (list_offset == 0) {
+		free(list);
 		return NULL;
+	}
+	list[list_offset] = NULL;
+	return list;
+}
 
-	size_t list_size = 128;
-	char **list = calloc(list_size,  sizeof(*list));
-	size_t list_offset = 0;
+typedef struct fuzzy_state {
+	const trie_t *trie;
+	const char *key;
+	size_t keylen;
+	size_t maxdist;
+	size_t *rows;		/* one row of the DP matrix per depth */
+	char *prefix;
+	trie_match *matches;
+	size_t nmatches;
+	size_t size;
+} fuzzy_state;
 
-	if (subtrie->value != 0)
-		list[list_offset++] = strdup(prefix);
+static size_t
+min3(size_t i, size_t j, size_t k)
+{
+	size_t min = i;
+	if (min > j)
+		min = j;
+	if (min > k)
+		min = k;
+	return min;
+}
+
+static void
+fuzzy_add_match(fuzzy_state *s, size_t len, size_t count, size_t distance)
+{
+	trie_match *m;
 
-	collect(subtrie->middle, prefix, list, &list_offset, &list_size);
-	qsort(list, list_offset, sizeof(*list), _compare_strings);
-	if (list_offset == list_size)
-		list = realloc(list, (list_size + 1) * sizeof(*list));
+	if (s->nmatches == s->size) {
+		s->size = s->size ? s->size * 2 : 16;
+		m = realloc(s->matches, s->size * sizeof(*m));
+		if (m == NULL)
+			err(EXIT_FAILURE, "malloc failed");
+		s->matches = m;
+	}
+	m = &s->matches[s->nmatches++];
+	if ((m->word = malloc(len + 1)) == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	memcpy(m->word, s->prefix, len);
+	m->word[len] = 0;
+	m->count = count;
+	m->distance = distance;
+}
 
-	list[list_offset] = NULL;
-	return list;
+/*
+ * Visits the node idx, and its siblings, whose character sits at position
+ * depth of the words below it. Row depth of the matrix holds the distances
+ * between the prefix leading here and every prefix of the key; the row for
+ * depth + 1 is computed from it and the node's character, and the middle
+ * subtree is only entered while some cell of that row is within maxdist.
+ */
+static void
+fuzzy_visit(fuzzy_state *s, uint32_t idx, size_t depth)
+{
+	const trie_node_t *n;
+	size_t width = s->keylen + 1;
+	size_t *prev, *row, *prev2;
+	size_t j, cost, rowmin;
+	char c;
+
+	for (;;) {
+		n = &s->trie->nodes[idx];
+		if (n->left != TRIE_NIL)
+			fuzzy_visit(s, n->left, depth);
+
+		c = n->character;
+		s->prefix[depth] = c;
+		prev = &s->rows[depth * width];
+		row = &s->rows[(depth + 1) * width];
+		prev2 = depth > 0 ? &s->rows[(depth - 1) * width] : NULL;
+		row[0] = depth + 1;
+		rowmin = row[0];
+		for (j = 1; j <= s->keylen; j++) {
+			cost = s->key[j - 1] == c ? 0 : 1;
+			row[j] = min3(prev[j] + 1, row[j - 1] + 1, prev[j - 1] + cost);
+			/* Transposition of two adjacent characters (Damerau) */
+			if (prev2 != NULL && j > 1 && s->key[j - 1] == s->prefix[depth - 1] &&
+			    s->key[j - 2] == c && prev2[j - 2] + 1 < row[j])
+				row[j] = prev2[j - 2] + 1;
+			if (row[j] < rowmin)
+				rowmin = row[j];
+		}
+
+		if (n->value != 0 && row[s->keylen] <= s->maxdist)
+			fuzzy_add_match(s, depth + 1, n->value, row[s->keylen]);
+		if (n->middle != TRIE_NIL && rowmin <= s->maxdist &&
+		    depth + 1 < s->keylen + s->maxdist)
+			fuzzy_visit(s, n->middle, depth + 1);
+
+		if ((idx = n->right) == TRIE_NIL)
+			break;
+	}
+}
+
+/*
+ * trie_fuzzy_search--
+ *  Returns all the words of the trie within a Damerau-Levenshtein
+ *  (optimal string alignment) distance of maxdist from key, along with
+ *  their counts and distances. The trie is walked once and a subtree is
+ *  abandoned as soon as no prefix of the key is within maxdist of the path
+ *  leading to it. The number of matches is stored in *nmatches; the array
+ *  must be released with free_trie_matches.
+ */
+trie_match *
+trie_fuzzy_search(trie_t *t, const char *key, size_t maxdist, size_t *nmatches)
+{
+	fuzzy_state s;
+	size_t j, depth;
+
+	*nmatches = 0;
+	if (t == NULL || key == NULL || t->nodes[0].character == 0)
+		return NULL;
+	if (key[0] == 0 && maxdist == 0)
+		return NULL;
+
+	s.trie = t;
+	s.key = key;
+	s.keylen = strlen(key);
+	s.maxdist = maxdist;
+	s.matches = NULL;
+	s.nmatches = 0;
+	s.size = 0;
+	/* No word longer than keylen + maxdist can be within reach */
+	depth = s.keylen + maxdist + 1;
+	s.rows = malloc(depth * (s.keylen + 1) * sizeof(*s.rows));
+	s.prefix = malloc(depth);
+	if (s.rows == NULL || s.prefix == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	for (j = 0; j <= s.keylen; j++)
+		s.rows[j] = j;
+
+	fuzzy_visit(&s, 0, 0);
+
+	free(s.rows);
+	free(s.prefix);
+	*nmatches = s.nmatches;
+	return s.matches;
+}
+
+void
+free_trie_matches(trie_match *matches, size_t nmatches)
+{
+	size_t i;
+
+	if (matches == NULL)
+		return;
+	for (i = 0; i < nmatches; i++)
+		free(matches[i].word);
+	free(matches);
 }
@@ -32,19 +32,78 @@
 
 #include <stdint.h>
 
-typedef struct trie_t {
-	struct trie_t *left;
-	struct trie_t *right;
-	struct trie_t *middle;
+/*
+ * Nodes live in a single arena owned by the trie_t and refer to each
+ * other by their index in it. Index 0 is always the root, which can never
+ * be a child, so TRIE_NIL doubles as the "no link" marker.
+ */
+#define TRIE_NIL 0
+
+/*
+ * best is an upper bound on the largest value stored in the subtree of a
+ * node, that is the node itself and everything under its left, middle and
+ * right links. It lets trie_top_completions go straight for the most
+ * frequent words.
+ */
+typedef struct trie_node_t {
+	uint32_t left;
+	uint32_t middle;
+	uint32_t right;
 	uint32_t value;
+	uint32_t best;
 	char character;
+} trie_node_t;
+
+/*
+ * size is 0 when the trie does not own its nodes, e.g. when they come
+ * from a dictionary image mapped with trie_map(); such a trie is read-only.
+ */
+typedef struct trie_t {
+	trie_node_t *nodes;
+	uint32_t nnodes;
+	uint32_t size;
 } trie_t;
 
+/*
+ * A cursor over the words sharing a prefix; see trie_iter_init. The
+ * current word is kept in the caller's buffer and doubles as the resume
+ * token.
+ */
+typedef struct trie_iter {
+	trie_t *trie;
+	char *buf;
+	size_t bufsize;
+	size_t len;
+	size_t prefixlen;
+	int started;
+	int truncated;		/* buf holds the part of a word too long for it */
+	int done;
+} trie_iter;
+
+/* Longest word get_prefix_matches can return */
+#define TRIE_MAX_WORD 256
+
+typedef struct trie_match {
+	char *word;
+	size_t count;
+	size_t distance;
+} trie_match;
+
 trie_t *trie_init(void);
+trie_t *trie_map(trie_node_t *, uint32_t);
+trie_t *trie_clone(const trie_t *);
 void trie_insert(trie_t **, const char *, size_t);
+void trie_bulk_insert(trie_t **, char **, const size_t *, size_t);
 size_t trie_get(trie_t *, const char *);
+void trie_get_batch(trie_t *, char **, size_t, size_t *);
 void trie_destroy(trie_t *);
-trie_t *get_subtrie(trie_t *, const char *);
+trie_node_t *get_subtrie(trie_t *, const char *);
+size_t trie_prefix_len(trie_t *, const char *);
+int trie_iter_init(trie_iter *, trie_t *, const char *, const char *, char *, size_t);
+int trie_iter_next(trie_iter *, size_t *);
 char **get_prefix_matches(trie_t *, const char *);
+trie_match *trie_top_completions(trie_t *, const char *, size_t, size_t *);
+trie_match *trie_fuzzy_search(trie_t *, const char *, size_t, size_t *);
+void free_trie_matches(trie_match *, size_t);
 
 #endif
@@ -1,7 +1,219 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "test_util.h"
 #include "trie.h"
 
+static trie_t *
+make_trie(char words[][16])
+{
+	trie_t *t = trie_init();
+	size_t i;
+
+	for (i = 0; i < NWORDS; i++) {
+		make_word(i, words[i]);
+		trie_insert(&t, words[i], i + 1);
+	}
+	return t;
+}
+
+/*
+ * The arena starts small and doubles: every word must survive the moves
+ * of the nodes, whether inserted one by one or in bulk.
+ */
+static void
+test_arena_growth(char words[][16])
+{
+	char *sorted[NWORDS];
+	size_t counts[NWORDS];
+	trie_t *t = make_trie(words), *bulk = trie_init();
+	size_t i, bad = 0;
+
+	check(t->nnodes > 1024 && t->size >= t->nnodes, "arena: grown");
+	for (i = 0; i < NWORDS; i++)
+		if (trie_get(t, words[i]) != i + 1)
+			bad++;
+	check(bad == 0, "arena: every word found after growing");
+	check(trie_get(t, "zzzzz") == 0 && trie_get(t, "a") == 1,
+	    "arena: absent and one letter words");
+
+	/* make_word lists the words in shortlex order, sort them for bulk */
+	for (i = 0; i < NWORDS; i++) {
+		sorted[i] = words[i];
+		counts[i] = i + 1;
+	}
+	for (i = 1; i < NWORDS; i++) {
+		size_t j = i;
+		while (j > 0 && strcmp(sorted[j - 1], sorted[j]) > 0) {
+			char *w = sorted[j];
+			size_t c = counts[j];
+			sorted[j] = sorted[j - 1];
+			counts[j] = counts[j - 1];
+			sorted[j - 1] = w;
+			counts[j - 1] = c;
+			j--;
+		}
+	}
+	trie_bulk_insert(&bulk, sorted, counts, NWORDS);
+	bad = 0;
+	for (i = 0; i < NWORDS; i++)
+		if (trie_get(bulk, words[i]) != i + 1)
+			bad++;
+	check(bad == 0, "arena: every word found after bulk insert");
+	trie_destroy(bulk);
+	trie_destroy(t);
+}
+
+/* Batches mixing present and absent keys agree with trie_get */
+static void
+test_batch(char words[][16])
+{
+	char *keys[2 * NWORDS];
+	char absent[NWORDS][20];
+	size_t counts[2 * NWORDS];
+	trie_t *t = make_trie(words);
+	size_t i, bad = 0;
+
+	for (i = 0; i < NWORDS; i++) {
+		snprintf(absent[i], sizeof(absent[i]), "%sq9", words[i]);
+		keys[2 * i] = words[i];
+		keys[2 * i + 1] = absent[i];
+	}
+	trie_get_batch(t, keys, 2 * NWORDS, counts);
+	for (i = 0; i < 2 * NWORDS; i++)
+		if (counts[i] != trie_get(t, keys[i]))
+			bad++;
+	check(bad == 0, "batch: agrees with trie_get");
+	check(counts[0] == 1 && counts[1] == 0, "batch: present and absent");
+	/* Fewer keys than a batch, and none at all */
+	trie_get_batch(t, keys, 3, counts);
+	check(counts[0] == 1 && counts[1] == 0 && counts[2] == 2,
+	    "batch: short batch");
+	trie_get_batch(t, keys, 0, counts);
+	trie_destroy(t);
+}
+
+/* The top completions are the most frequent matches, in that order */
+static void
+test_top_completions(char words[][16])
+{
+	const char *prefixes[] = { "a", "ab", "g", "zz", "gq" };
+	trie_t *t = make_trie(words);
+	trie_match *matches;
+	char **all;
+	size_t i, j, n, nall, k, best, prev, bad;
+
+	for (i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+		all = get_prefix_matches(t, prefixes[i]);
+		nall = count_words(all);
+		for (k = 1; k <= 20; k += 19) {
+			matches = trie_top_completions(t, prefixes[i], k, &n);
+			check(n == (nall < k ? nall : k), "top-k: number of matches");
+			bad = 0;
+			prev = (size_t) -1;
+			for (j = 0; j < n; j++) {
+				if (matches[j].count > prev ||
+				    matches[j].count != trie_get(t, matches[j].word) ||
+				    strncmp(matches[j].word, prefixes[i],
+				    strlen(prefixes[i])) != 0)
+					bad++;
+				prev = matches[j].count;
+			}
+			/* Nothing left out beats the last one returned */
+			for (j = 0, best = 0; j < nall; j++)
+				if (trie_get(t, all[j]) > best)
+					best = trie_get(t, all[j]);
+			if (n > 0 && matches[0].count != best)
+				bad++;
+			check(bad == 0, "top-k: ordered by count");
+			free_trie_matches(matches, n);
+		}
+		free_words(all);
+	}
+	check(trie_top_completions(t, "a", 0, &n) == NULL && n == 0,
+	    "top-k: k == 0");
+	trie_destroy(t);
+}
+
+/*
+ * The last word returned resumes the walk right after it, in a fresh
+ * iterator, without repeating or skipping any word.
+ */
+static void
+test_resume(char words[][16])
+{
+	char buf[TRIE_MAX_WORD], token[TRIE_MAX_WORD];
+	char **all;
+	trie_iter it;
+	trie_t *t = make_trie(words);
+	size_t i = 0, count, bad = 0;
+
+	all = get_prefix_matches(t, "b");
+	trie_iter_init(&it, t, "b", NULL, buf, sizeof(buf));
+	while (trie_iter_next(&it, &count) == 1) {
+		if (all[i] == NULL || strcmp(all[i], buf) != 0 ||
+		    count != trie_get(t, buf))
+			bad++;
+		i++;
+		/* Hand over to a new iterator every 7 words */
+		if (i % 7 == 0) {
+			memcpy(token, buf, strlen(buf) + 1);
+			trie_iter_init(&it, t, "b", token, buf, sizeof(buf));
+		}
+	}
+	check(bad == 0 && all[i] == NULL, "resume: every word once, in order");
+	check(trie_iter_init(&it, t, "b", "cat", buf, sizeof(buf)) == -1,
+	    "resume: token without the prefix");
+	free_words(all);
+	trie_destroy(t);
+}
+
+/*
+ * A word too long for the iterator buffer is skipped on its own: the walk
+ * goes on with the words after it, and get_prefix_matches still returns
+ * all of them.
+ */
+static void
+test_long_word(void)
+{
+	char longword[TRIE_MAX_WORD + 64];
+	char buf[TRIE_MAX_WORD];
+	char **matches;
+	trie_iter it;
+	trie_t *t = trie_init();
+	size_t count, i;
+
+	memset(longword, 'b', sizeof(longword) - 1);
+	longword[0] = 'a';
+	longword[sizeof(longword) - 1] = 0;
+	trie_insert(&t, "a", 1);
+	trie_insert(&t, "ab", 2);
+	trie_insert(&t, longword, 3);
+	trie_insert(&t, "abc", 4);
+	trie_insert(&t, "ac", 5);
+
+	trie_iter_init(&it, t, "a", NULL, buf, sizeof(buf));
+	check(trie_iter_next(&it, &count) == 1 && strcmp(buf, "a") == 0,
+	    "iterator: a");
+	check(trie_iter_next(&it, &count) == 1 && strcmp(buf, "ab") == 0,
+	    "iterator: ab");
+	check(trie_iter_next(&it, &count) == -1, "iterator: long word reported");
+	check(trie_iter_next(&it, &count) == 1 && strcmp(buf, "abc") == 0 &&
+	    count == 4, "iterator: abc after the long word");
+	check(trie_iter_next(&it, &count) == 1 && strcmp(buf, "ac") == 0 &&
+	    count == 5, "iterator: ac after the long word");
+	check(trie_iter_next(&it, &count) == 0, "iterator: end");
+
+	matches = get_prefix_matches(t, "a");
+	i = count_words(matches);
+	check(i == 5, "get_prefix_matches: every word");
+	check(i == 5 && strcmp(matches[2], longword) == 0 &&
+	    strcmp(matches[3], "abc") == 0, "get_prefix_matches: long word");
+	free_words(matches);
+	trie_destroy(t);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -9,6 +221,7 @@ main(int argc, char **argv)
 	const char *s2 = "world";
 	const char *s3 = "hell";
 	const char *s4 = "woo";
+	static char words[NWORDS][16];
 
 	trie_t *t = trie_init();
 	trie_insert(&t, s1, 1);
@@ -20,5 +233,12 @@ main(int argc, char **argv)
 	printf("%s: %zu\n", s2, trie_get(t, s2));
 	printf("%s: %zu\n", s3, trie_get(t, s3));
 	printf("%s: %zu\n", s4, trie_get(t, s4));
-	return 0;
+	trie_destroy(t);
+
+	test_arena_growth(words);
+	test_batch(words);
+	test_top_completions(words);
+	test_resume(words);
+	test_long_word();
+	return test_result();
 }
@@ -0,0 +1,267 @@
+/*-
+ * Copyright (c) 2017 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "workpool.h"
+
+/*
+ * The tasks [lo, hi) a thread has yet to run. The owner takes them from
+ * the bottom and thieves from the top, both under lock.
+ */
+typedef struct workpool_range {
+	pthread_mutex_t lock;
+	size_t lo;
+	size_t hi;
+} workpool_range;
+
+typedef struct workpool_thread {
+	struct workpool *pool;
+	size_t self;
+} workpool_thread;
+
+struct workpool {
+	pthread_mutex_t busy;		/* held for the whole of a job */
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	pthread_t *threads;
+	workpool_thread *args;
+	workpool_range *ranges;		/* one per thread, the caller's first */
+	size_t nthreads;		/* not counting the caller */
+	size_t running;
+	unsigned long job;
+	int quit;
+	void (*fn)(void *, size_t);
+	void *arg;
+};
+
+/*
+ * Takes the next task of range r, or steals half of the range with the
+ * most tasks left into it. Returns 0 once no task is left anywhere.
+ */
+static int
+next_task(workpool_t *pool, size_t self, size_t *task)
+{
+	workpool_range *r = &pool->ranges[self];
+	workpool_range *victim;
+	size_t i, n, best, left, lo, hi;
+
+	for (;;) {
+		pthread_mutex_lock(&r->lock);
+		if (r->lo < r->hi) {
+			*task = r->lo++;
+			pthread_mutex_unlock(&r->lock);
+			return 1;
+		}
+		pthread_mutex_unlock(&r->lock);
+
+		/* The sizes are only a hint, the victim is checked under lock */
+		best = self;
+		left = 0;
+		for (i = 0; i <= pool->nthreads; i++) {
+			pthread_mutex_lock(&pool->ranges[i].lock);
+			n = pool->ranges[i].hi - pool->ranges[i].lo;
+			pthread_mutex_unlock(&pool->ranges[i].lock);
+			if (n > left) {
+				best = i;
+				left = n;
+			}
+		}
+		if (left == 0)
+			return 0;
+
+		victim = &pool->ranges[best];
+		pthread_mutex_lock(&victim->lock);
+		n = victim->hi - victim->lo;
+		if (n == 0) {
+			pthread_mutex_unlock(&victim->lock);
+			continue;
+		}
+		hi = victim->hi;
+		lo = hi - (n + 1) / 2;
+		victim->hi = lo;
+		pthread_mutex_unlock(&victim->lock);
+
+		pthread_mutex_lock(&r->lock);
+		r->lo = lo;
+		r->hi = hi;
+		pthread_mutex_unlock(&r->lock);
+	}
+}
+
+static void
+run_tasks(workpool_t *pool, size_t self)
+{
+	size_t task;
+
+	while (next_task(pool, self, &task))
+		pool->fn(pool->arg, task);
+}
+
+static void *
+worker(void *arg)
+{
+	workpool_thread *t = arg;
+	workpool_t *pool = t->pool;
+	unsigned long job = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->quit && pool->job == job)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if (pool->quit)
+			break;
+		job = pool->job;
+		pthread_mutex_unlock(&pool->lock);
+
+		run_tasks(pool, t->self);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->running == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/*
+ * workpool_init--
+ *  Starts a pool of nthreads - 1 threads, which together with the one
+ *  calling workpool_run make nthreads.
+ */
+workpool_t *
+workpool_init(size_t nthreads)
+{
+	workpool_t *pool;
+	size_t i;
+
+	if (nthreads < 1)
+		nthreads = 1;
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	pool->nthreads = nthreads - 1;
+	pool->ranges = calloc(nthreads, sizeof(*pool->ranges));
+	pool->threads = calloc(nthreads, sizeof(*pool->threads));
+	pool->args = calloc(nthreads, sizeof(*pool->args));
+	if (pool->ranges == NULL || pool->threads == NULL || pool->args == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	pthread_mutex_init(&pool->busy, NULL);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	for (i = 0; i < nthreads; i++)
+		pthread_mutex_init(&pool->ranges[i].lock, NULL);
+
+	for (i = 0; i < pool->nthreads; i++) {
+		pool->args[i].pool = pool;
+		pool->args[i].self = i + 1;
+		if (pthread_create(&pool->threads[i], NULL, worker, &pool->args[i]) != 0) {
+			warnx("pthread_create failed");
+			pool->nthreads = i;
+			workpool_destroy(pool);
+			return NULL;
+		}
+	}
+	return pool;
+}
+
+size_t
+workpool_size(const workpool_t *pool)
+{
+	return pool->nthreads + 1;
+}
+
+/*
+ * workpool_run--
+ *  Runs fn(arg, task) for every task from 0 to ntasks - 1 and returns once
+ *  they are all done. The calling thread takes its share of the tasks.
+ *  The pool runs one job at a time: if it is busy with the job of another
+ *  thread, -1 is returned straight away and nothing is run.
+ */
+int
+workpool_run(workpool_t *pool, size_t ntasks, void (*fn)(void *, size_t), void *arg)
+{
+	size_t i, n = pool->nthreads + 1;
+
+	if (pthread_mutex_trylock(&pool->busy) != 0)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		pool->ranges[i].lo = ntasks * i / n;
+		pool->ranges[i].hi = ntasks * (i + 1) / n;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->fn = fn;
+	pool->arg = arg;
+	pool->running = pool->nthreads;
+	pool->job++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	run_tasks(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->running > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	pthread_mutex_unlock(&pool->busy);
+	return 0;
+}
+
+void
+workpool_destroy(workpool_t *pool)
+{
+	size_t i;
+
+	if (pool == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	for (i = 0; i < pool->nthreads + 1; i++)
+		pthread_mutex_destroy(&pool->ranges[i].lock);
+	pthread_mutex_destroy(&pool->busy);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->start);
+	pthread_cond_destroy(&pool->done);
+	free(pool->ranges);
+	free(pool->threads);
+	free(pool->args);
+	free(pool);
+}
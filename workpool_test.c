@@ -0,0 +1,81 @@
+#include <string.h>
+
+#include "test_util.h"
+#include "workpool.h"
+
+/* Most tasks a job is given */
+#define MAX_TASKS 5000
+
+/* Every task records its index and how many times it ran */
+typedef struct task_job {
+	workpool_t *pool;
+	size_t seen[MAX_TASKS];
+	unsigned int runs[MAX_TASKS];
+	int nested;
+} task_job;
+
+static void
+record_task(void *arg, size_t task)
+{
+	task_job *job = arg;
+
+	job->seen[task] = task;
+	__atomic_add_fetch(&job->runs[task], 1, __ATOMIC_RELAXED);
+}
+
+/* The pool is busy with this very job, so it refuses another one */
+static void
+nested_task(void *arg, size_t task)
+{
+	task_job *job = arg;
+
+	if (workpool_run(job->pool, 1, record_task, job) == -1)
+		__atomic_add_fetch(&job->nested, 1, __ATOMIC_RELAXED);
+}
+
+/* Every task runs exactly once, whatever the number of threads and tasks */
+static void
+test_pool(size_t nthreads, task_job *job)
+{
+	const size_t ntasks[] = { 0, 1, 3, 64, MAX_TASKS };
+	workpool_t *pool = workpool_init(nthreads);
+	size_t i, j, bad;
+
+	check(pool != NULL, "workpool_init");
+	if (pool == NULL)
+		return;
+	check(workpool_size(pool) == (nthreads < 1 ? 1 : nthreads),
+	    "workpool_size");
+	job->pool = pool;
+	for (i = 0; i < sizeof(ntasks) / sizeof(ntasks[0]); i++) {
+		memset(job->seen, 0xff, sizeof(job->seen));
+		memset(job->runs, 0, sizeof(job->runs));
+		check(workpool_run(pool, ntasks[i], record_task, job) == 0,
+		    "workpool_run");
+		bad = 0;
+		for (j = 0; j < ntasks[i]; j++)
+			if (job->runs[j] != 1 || job->seen[j] != j)
+				bad++;
+		for (; j < MAX_TASKS; j++)
+			if (job->runs[j] != 0 || job->seen[j] != (size_t) -1)
+				bad++;
+		check(bad == 0, "workpool_run: every task once, none beyond");
+	}
+
+	job->nested = 0;
+	workpool_run(pool, 16, nested_task, job);
+	check(job->nested == 16, "workpool_run: busy pool refused");
+	workpool_destroy(pool);
+}
+
+int
+main(int argc, char **argv)
+{
+	static task_job job;
+	const size_t nthreads[] = { 0, 1, 2, 4, 7 };
+	size_t i;
+
+	for (i = 0; i < sizeof(nthreads) / sizeof(nthreads[0]); i++)
+		test_pool(nthreads[i], &job);
+	return test_result();
+}